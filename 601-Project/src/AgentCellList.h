@@ -0,0 +1,75 @@
+/*
+* Agents bucketed by the soil voxel they are in, so neighbour queries only look at the few voxels around a point
+* It is rebuilt from scratch every step with a counting sort: count agents per voxel, prefix sum the counts, then scatter the slots
+* Queries only read the lists, so any number of threads can run them at once
+*/
+#pragma once
+#include <glm/glm.hpp>
+#include <algorithm>
+#include <vector>
+#include "MultiResolution.h"
+
+class AgentCellList {
+public:
+	//Pool is AgentPool, anything with slotCount(), capacity(), isActive(slot) and position(slot) works
+	template <typename Pool>
+	void build(const Pool& agents, glm::ivec3 _dimensions) {
+		dimensions = _dimensions;
+		int cellCount = dimensions.x * dimensions.y * dimensions.z;
+		if (static_cast<int>(cellStart.size()) != cellCount + 1) {
+			cellStart.assign(cellCount + 1, 0);
+			cellOfSlot.assign(agents.capacity(), -1);
+			entries.assign(agents.capacity(), -1);
+		}
+		std::fill(cellStart.begin(), cellStart.end(), 0);
+
+		int slotCount = agents.slotCount();
+		for (int slot = 0; slot < slotCount; slot++) {
+			cellOfSlot[slot] = agents.isActive(slot) ? cellIndex(glm::ivec3(soilCellOf(agents.position(slot)))) : -1;
+			if (cellOfSlot[slot] >= 0)
+				cellStart[cellOfSlot[slot] + 1]++;
+		}
+		for (int cell = 0; cell < cellCount; cell++)
+			cellStart[cell + 1] += cellStart[cell];
+		//scatter with a running cursor per cell, cellStart is shifted back afterwards
+		for (int slot = 0; slot < slotCount; slot++) {
+			if (cellOfSlot[slot] >= 0)
+				entries[cellStart[cellOfSlot[slot]]++] = slot;
+		}
+		for (int cell = cellCount; cell > 0; cell--)
+			cellStart[cell] = cellStart[cell - 1];
+		cellStart[0] = 0;
+	}
+
+	//call fn(slot) for every agent within radius (pheromone voxels) of position, in cell order
+	template <typename Pool, typename F>
+	void forEachNear(const Pool& agents, glm::vec3 position, float radius, const F& fn) const {
+		glm::ivec3 low = glm::max(glm::ivec3(soilCellOf(position - glm::vec3(radius))), glm::ivec3(0));
+		glm::ivec3 high = glm::min(glm::ivec3(soilCellOf(position + glm::vec3(radius))), dimensions - 1);
+		float radius2 = radius * radius;
+		for (int z = low.z; z <= high.z; z++)
+			for (int y = low.y; y <= high.y; y++)
+				for (int x = low.x; x <= high.x; x++) {
+					int cell = cellIndex(glm::ivec3(x, y, z));
+					for (int e = cellStart[cell]; e < cellStart[cell + 1]; e++) {
+						glm::vec3 offset = agents.position(entries[e]) - position;
+						if (glm::dot(offset, offset) <= radius2)
+							fn(entries[e]);
+					}
+				}
+	}
+
+	//number of agents in a soil voxel
+	int count(glm::ivec3 cell) const {
+		int index = cellIndex(cell);
+		return cellStart[index + 1] - cellStart[index];
+	}
+
+private:
+	int cellIndex(glm::ivec3 cell) const { return cell.x + dimensions.x * (cell.y + dimensions.y * cell.z); }
+
+	glm::ivec3 dimensions = glm::ivec3(0);
+	std::vector<int> cellStart; //agents of cell c are entries[cellStart[c], cellStart[c + 1])
+	std::vector<int> cellOfSlot;
+	std::vector<int> entries;
+};
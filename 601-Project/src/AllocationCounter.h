@@ -0,0 +1,96 @@
+/*
+* Counts global heap allocations so the simulation step can be checked to be allocation free
+* When CHECK_STEP_ALLOCATIONS is enabled this header replaces the global operator new, so it must only be included by the file with
+* main() (main.cpp, tests/headless.cpp)
+* Threads that are not part of the simulation (the render loop) call ignoreAllocationsOnThisThread so their allocations are not counted
+*/
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+#include "settings.h"
+
+std::atomic<long long> countedAllocations{ 0 };
+thread_local bool ignoreAllocations = false;
+
+inline void ignoreAllocationsOnThisThread() {
+	ignoreAllocations = true;
+}
+
+//allocations made by counted threads so far
+inline long long allocationCount() {
+	return countedAllocations.load(std::memory_order_relaxed);
+}
+
+#if CHECK_STEP_ALLOCATIONS
+
+inline void* countedAllocate(std::size_t size, std::size_t alignment) {
+	if (!ignoreAllocations)
+		countedAllocations.fetch_add(1, std::memory_order_relaxed);
+	if (size == 0)
+		size = 1;
+#ifdef _WIN32
+	void* memory = _aligned_malloc(size, alignment);
+#else
+	void* memory = nullptr;
+	if (posix_memalign(&memory, alignment < sizeof(void*) ? sizeof(void*) : alignment, size) != 0)
+		memory = nullptr;
+#endif
+	return memory;
+}
+
+//every replaced operator new allocates with posix_memalign, so free is the matching release. GCC only sees an operator new
+//paired with free where this is inlined into a delete, and warns about the pairing it cannot see through
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+inline void countedFree(void* memory) {
+#ifdef _WIN32
+	_aligned_free(memory);
+#else
+	free(memory);
+#endif
+}
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+
+void* operator new(std::size_t size) {
+	void* memory = countedAllocate(size, alignof(std::max_align_t));
+	if (memory == nullptr)
+		throw std::bad_alloc();
+	return memory;
+}
+void* operator new[](std::size_t size) {
+	return operator new(size);
+}
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept {
+	return countedAllocate(size, alignof(std::max_align_t));
+}
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept {
+	return countedAllocate(size, alignof(std::max_align_t));
+}
+void* operator new(std::size_t size, std::align_val_t alignment) {
+	void* memory = countedAllocate(size, static_cast<std::size_t>(alignment));
+	if (memory == nullptr)
+		throw std::bad_alloc();
+	return memory;
+}
+void* operator new[](std::size_t size, std::align_val_t alignment) {
+	return operator new(size, alignment);
+}
+
+void operator delete(void* memory) noexcept { countedFree(memory); }
+void operator delete[](void* memory) noexcept { countedFree(memory); }
+void operator delete(void* memory, std::size_t) noexcept { countedFree(memory); }
+void operator delete[](void* memory, std::size_t) noexcept { countedFree(memory); }
+void operator delete(void* memory, const std::nothrow_t&) noexcept { countedFree(memory); }
+void operator delete[](void* memory, const std::nothrow_t&) noexcept { countedFree(memory); }
+void operator delete(void* memory, std::align_val_t) noexcept { countedFree(memory); }
+void operator delete[](void* memory, std::align_val_t) noexcept { countedFree(memory); }
+void operator delete(void* memory, std::size_t, std::align_val_t) noexcept { countedFree(memory); }
+void operator delete[](void* memory, std::size_t, std::align_val_t) noexcept { countedFree(memory); }
+
+#endif
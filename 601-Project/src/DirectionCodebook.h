@@ -0,0 +1,67 @@
+/*
+* A table of values precomputed for a fixed set of unit directions, looked up by quantising a direction to the nearest entry
+* The directions are an octahedral grid: the sphere is folded onto the octahedron |x| + |y| + |z| = 1 and flattened into a
+* resolution x resolution square, which covers the sphere much more evenly than a latitude/longitude grid
+*/
+#pragma once
+#include <glm/glm.hpp>
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+//map a unit direction to the octahedral square [-1, 1]^2
+inline glm::vec2 octahedralEncode(glm::vec3 direction) {
+	glm::vec3 d = direction / (std::abs(direction.x) + std::abs(direction.y) + std::abs(direction.z));
+	glm::vec2 p(d.x, d.y);
+	if (d.z < 0) {
+		//fold the lower half over the diagonals
+		p = glm::vec2((1 - std::abs(d.y)) * (d.x >= 0 ? 1 : -1), (1 - std::abs(d.x)) * (d.y >= 0 ? 1 : -1));
+	}
+	return p;
+}
+
+//map a point of the octahedral square back to a unit direction
+inline glm::vec3 octahedralDecode(glm::vec2 p) {
+	glm::vec3 d(p.x, p.y, 1 - std::abs(p.x) - std::abs(p.y));
+	if (d.z < 0) {
+		d.x = (1 - std::abs(p.y)) * (p.x >= 0 ? 1 : -1);
+		d.y = (1 - std::abs(p.x)) * (p.y >= 0 ? 1 : -1);
+	}
+	return glm::normalize(d);
+}
+
+template <typename Entry>
+class DirectionCodebook {
+public:
+	//build(direction) computes the entry of a direction, it is called resolution^2 times up front
+	template <typename F>
+	DirectionCodebook(int _resolution, const F& build) : resolution(_resolution) {
+		entries.reserve(resolution * resolution);
+		for (int v = 0; v < resolution; v++)
+			for (int u = 0; u < resolution; u++)
+				entries.push_back(build(direction(u + v * resolution)));
+	}
+
+	int size() const { return static_cast<int>(entries.size()); }
+
+	//index of the codebook direction closest to a unit direction
+	int quantise(glm::vec3 direction) const {
+		glm::vec2 p = (octahedralEncode(direction) * 0.5f + 0.5f) * float(resolution);
+		int u = std::min(static_cast<int>(p.x), resolution - 1);
+		int v = std::min(static_cast<int>(p.y), resolution - 1);
+		return u + v * resolution;
+	}
+
+	//the direction at the centre of an entry's cell
+	glm::vec3 direction(int index) const {
+		glm::vec2 p((index % resolution + 0.5f) / resolution, (index / resolution + 0.5f) / resolution);
+		return octahedralDecode(p * 2.f - 1.f);
+	}
+
+	const Entry& lookup(glm::vec3 direction) const { return entries[quantise(direction)]; }
+	const Entry& operator[](int index) const { return entries[index]; }
+
+private:
+	int resolution;
+	std::vector<Entry> entries;
+};
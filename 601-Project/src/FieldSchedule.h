@@ -0,0 +1,114 @@
+/*
+* Local time stepping for the pheromone field: bricks far from anything happening advance less often, by more steps at a time
+* A brick is active when an agent is in it or pheromone was deposited in it since the last plan. Active bricks and their neighbours
+* advance every step, bricks two away every other step and the rest every MAX_FIELD_INTERVAL steps, steep bricks (whose values
+* still vary a lot) no slower than every other step. A brick that advances is given the number of steps since it last did,
+* so it never falls behind when its interval shrinks. Quiet bricks start out staggered so they do not all come due together
+* A brick that catches up on k steps diffuses once at k times the rate instead of k times at the rate, so its pheromone only
+* reaches the next voxel where k steps would carry it k voxels. Multi-rate stepping is a mode to turn on, the default is uniform
+*/
+#pragma once
+#include <glm/glm.hpp>
+#include <algorithm>
+#include <vector>
+#include "settings.h"
+#include "VoxelGrid.h"
+
+//how the pheromone field is stepped, set from the panel
+enum class FieldStepping { UNIFORM, MULTI_RATE };
+FieldStepping fieldStepping = FieldStepping::UNIFORM;
+
+class FieldSchedule {
+public:
+	//size the schedule for a grid, only allocates the first time
+	template <typename Voxel>
+	void prepare(VoxelGrid<Voxel>& grid) {
+		const int B = VoxelGrid<Voxel>::BRICK_SIZE;
+		glm::ivec3 dimensions = glm::ivec3(grid.getDimensions());
+		bricks = (dimensions + B - 1) / B;
+		if (static_cast<int>(lastStep.size()) == grid.getBrickCount())
+			return;
+		active.assign(grid.getBrickCount(), 0);
+		distance.assign(grid.getBrickCount(), 0);
+		elapsed.assign(grid.getBrickCount(), 0);
+		lastStep.resize(grid.getBrickCount());
+		for (int brick = 0; brick < grid.getBrickCount(); brick++)
+			lastStep[brick] = step - brick % MAX_FIELD_INTERVAL;
+		dueBricks.reserve(grid.getBrickCount());
+	}
+
+	//the brick has an agent in it or was deposited in, it advances every step until the next plan
+	void markActive(int brick) { active[brick] = 1; }
+	//the brick's values were just set as they are now, it has no steps to catch up on
+	void restart(int brick) { lastStep[brick] = step; }
+
+	/*
+	* Decide which bricks advance this step and forget which were active. steep(brick) tells whether a brick's values still vary
+	* enough that it should not wait more than 2 steps. With uniform stepping every brick advances by one step
+	*/
+	template <typename F>
+	void plan(const F& steep) {
+		step++;
+		dueBricks.clear();
+		int brickCount = static_cast<int>(lastStep.size());
+		if (fieldStepping == FieldStepping::UNIFORM) {
+			for (int brick = 0; brick < brickCount; brick++) {
+				elapsed[brick] = 1;
+				lastStep[brick] = step;
+				dueBricks.push_back(brick);
+			}
+			std::fill(active.begin(), active.end(), 0);
+			return;
+		}
+
+		//brick distance to the nearest active brick, only told apart up to 2
+		for (int brick = 0; brick < brickCount; brick++)
+			distance[brick] = active[brick] ? 0 : 3;
+		for (int ring = 1; ring <= 2; ring++) {
+			for (int brick = 0; brick < brickCount; brick++) {
+				if (distance[brick] != ring - 1)
+					continue;
+				glm::ivec3 b(brick % bricks.x, (brick / bricks.x) % bricks.y, brick / (bricks.x * bricks.y));
+				glm::ivec3 low = glm::max(b - 1, glm::ivec3(0));
+				glm::ivec3 high = glm::min(b + 1, bricks - 1);
+				for (int z = low.z; z <= high.z; z++)
+					for (int y = low.y; y <= high.y; y++)
+						for (int x = low.x; x <= high.x; x++) {
+							unsigned char& neighbour = distance[(z * bricks.y + y) * bricks.x + x];
+							neighbour = std::min<unsigned char>(neighbour, ring);
+						}
+			}
+		}
+
+		for (int brick = 0; brick < brickCount; brick++) {
+			int interval = distance[brick] <= 1 ? 1 : distance[brick] == 2 ? 2 : MAX_FIELD_INTERVAL;
+			if (interval > 2 && steep(brick))
+				interval = 2;
+			int since = step - lastStep[brick];
+			if (since >= interval) {
+				elapsed[brick] = since;
+				lastStep[brick] = step;
+				dueBricks.push_back(brick);
+			}
+			else
+				elapsed[brick] = 0;
+		}
+		std::fill(active.begin(), active.end(), 0);
+	}
+
+	//steps a brick advances by this step, 0 if it waits
+	int stepsOf(int brick) const { return elapsed[brick]; }
+	//the bricks that advance this step, in brick order
+	const std::vector<int>& due() const { return dueBricks; }
+
+private:
+	glm::ivec3 bricks = glm::ivec3(0);
+	int step = 0;
+	std::vector<unsigned char> active;
+	std::vector<unsigned char> distance;
+	std::vector<int> elapsed;
+	std::vector<int> lastStep; //the step each brick last advanced on
+	std::vector<int> dueBricks;
+};
+
+FieldSchedule pheromoneSchedule;
@@ -0,0 +1,128 @@
+/*
+* Soil resolution pheromones away from the agents, for long runs where the fine grid is not needed everywhere
+* The pheromone grid is split into tiles of TILE_CELLS^3 soil voxels, so a tile holds whole pheromone bricks and whole soil voxels
+* In the adaptive mode a tile that nothing has come near for COARSE_FIELD_DELAY steps is restricted to soil resolution and
+* simulated there, on 1/27 of the voxels. Its pheromone voxels are left holding the pattern they had. An agent or a deposit in the
+* tile or one next to it refines it again: the pattern is scaled to match the coarse values, so no pheromone is made or lost
+* This class keeps track of the tiles and holds the coarse values, Pheromones.h steps them
+*/
+#pragma once
+#include <glm/glm.hpp>
+#include <memory>
+#include <vector>
+#include "settings.h"
+#include "MultiResolution.h"
+#include "VoxelGrid.h"
+#include "soil.h"
+
+//how finely the pheromone field is simulated, set from the panel
+enum class FieldResolution { FINE, ADAPTIVE };
+FieldResolution fieldResolution = FieldResolution::FINE;
+
+template <typename Voxel>
+class FieldTiles {
+public:
+	static const int TILE_CELLS = 8; //soil voxels along a tile
+	static const int TILE_BRICKS = TILE_CELLS * PHEROMONE_RESOLUTION / VoxelGrid<Voxel>::BRICK_SIZE;
+	static_assert(TILE_CELLS * PHEROMONE_RESOLUTION % VoxelGrid<Voxel>::BRICK_SIZE == 0, "a tile must hold whole pheromone bricks");
+
+	//size the tiles for the grids, only allocates the first time
+	void prepare(SoilGrid& soil, VoxelGrid<Voxel>& pheromones) {
+		if (coarse)
+			return;
+		const int B = VoxelGrid<Voxel>::BRICK_SIZE;
+		cells = glm::ivec3(soil.getDimensions());
+		tiles = (cells + TILE_CELLS - 1) / TILE_CELLS;
+		bricks = (glm::ivec3(pheromones.getDimensions()) + B - 1) / B;
+		coarse = std::make_unique<VoxelGrid<Voxel>>(cells.x, cells.y, cells.z);
+		scratch.assign(static_cast<size_t>(coarse->getBrickCount()) * VoxelGrid<Voxel>::BRICK_VOLUME, Voxel());
+		int tileCount = tiles.x * tiles.y * tiles.z;
+		coarseState.assign(tileCount, 0);
+		visited.assign(tileCount, 0);
+		quietSteps.assign(tileCount, 0);
+		coarseBricks.assign(pheromones.getBrickCount(), 0);
+		coarseList.reserve(tileCount);
+	}
+
+	//something is at a pheromone position this step, its tile and the ones around it stay fine
+	void visit(glm::vec3 pheromonePos) {
+		if (!coarse)
+			return;
+		glm::ivec3 tile = glm::ivec3(soilCellOf(pheromonePos)) / TILE_CELLS;
+		glm::ivec3 low = glm::max(tile - 1, glm::ivec3(0));
+		glm::ivec3 high = glm::min(tile + 1, tiles - 1);
+		for (int z = low.z; z <= high.z; z++)
+			for (int y = low.y; y <= high.y; y++)
+				for (int x = low.x; x <= high.x; x++)
+					visited[tileIndex(glm::ivec3(x, y, z))] = 1;
+	}
+
+	/*
+	* Change the resolution of the tiles that need it, once everything near the field this step has visited it
+	* coarsen(cellMin, cellMax) is called before a tile goes coarse and refine(cellMin, cellMax, brickMin, brickMax) after it is fine
+	* again, the ranges are the tile's soil voxels and pheromone bricks, [min, max). In the fine mode every tile is refined
+	*/
+	template <typename Coarsen, typename Refine>
+	void update(const Coarsen& coarsen, const Refine& refine) {
+		coarseList.clear();
+		for (int tile = 0; tile < static_cast<int>(coarseState.size()); tile++) {
+			quietSteps[tile] = visited[tile] ? 0 : quietSteps[tile] + 1;
+			visited[tile] = 0;
+			bool wantsCoarse = fieldResolution == FieldResolution::ADAPTIVE && quietSteps[tile] >= COARSE_FIELD_DELAY;
+			glm::ivec3 cellMin, cellMax, brickMin, brickMax;
+			ranges(tile, cellMin, cellMax, brickMin, brickMax);
+			if (coarseState[tile] && !wantsCoarse) {
+				markBricks(brickMin, brickMax, 0);
+				coarseState[tile] = 0;
+				refine(cellMin, cellMax, brickMin, brickMax);
+			}
+			else if (!coarseState[tile] && wantsCoarse) {
+				coarsen(cellMin, cellMax);
+				markBricks(brickMin, brickMax, 1);
+				coarseState[tile] = 1;
+			}
+			if (coarseState[tile])
+				coarseList.push_back(tile);
+		}
+	}
+
+	bool isCoarseBrick(int brick) const { return !coarseBricks.empty() && coarseBricks[brick]; }
+	bool isCoarseCell(glm::ivec3 cell) const { return coarse && coarseState[tileIndex(cell / TILE_CELLS)]; }
+
+	//the tiles at soil resolution, in tile order
+	const std::vector<int>& coarseTiles() const { return coarseList; }
+	//the soil voxels [cellMin, cellMax) and pheromone bricks [brickMin, brickMax) of a tile, clipped to the grids
+	void ranges(int tile, glm::ivec3& cellMin, glm::ivec3& cellMax, glm::ivec3& brickMin, glm::ivec3& brickMax) const {
+		glm::ivec3 t(tile % tiles.x, (tile / tiles.x) % tiles.y, tile / (tiles.x * tiles.y));
+		cellMin = t * TILE_CELLS;
+		cellMax = glm::min(cellMin + TILE_CELLS, cells);
+		brickMin = t * TILE_BRICKS;
+		brickMax = glm::min(brickMin + TILE_BRICKS, bricks);
+	}
+	int brickIndex(glm::ivec3 brick) const { return (brick.z * bricks.y + brick.y) * bricks.x + brick.x; }
+
+	//the coarse values, one voxel per soil voxel, and what the next ones are summed into while the field steps
+	VoxelGrid<Voxel>& coarseGrid() { return *coarse; }
+	Voxel& coarseAt(glm::ivec3 cell) { return coarse->peek(coarse->posToIndex(glm::vec3(cell))); }
+	Voxel& coarseNext(glm::ivec3 cell) { return scratch[coarse->posToIndex(glm::vec3(cell))]; }
+
+private:
+	int tileIndex(glm::ivec3 tile) const { return (tile.z * tiles.y + tile.y) * tiles.x + tile.x; }
+	void markBricks(glm::ivec3 brickMin, glm::ivec3 brickMax, unsigned char value) {
+		for (int z = brickMin.z; z < brickMax.z; z++)
+			for (int y = brickMin.y; y < brickMax.y; y++)
+				for (int x = brickMin.x; x < brickMax.x; x++)
+					coarseBricks[brickIndex(glm::ivec3(x, y, z))] = value;
+	}
+
+	glm::ivec3 cells = glm::ivec3(0);
+	glm::ivec3 tiles = glm::ivec3(0);
+	glm::ivec3 bricks = glm::ivec3(0);
+	std::unique_ptr<VoxelGrid<Voxel>> coarse;
+	std::vector<Voxel> scratch;
+	std::vector<unsigned char> coarseState; //per tile, 1 while it is at soil resolution
+	std::vector<unsigned char> visited; //per tile, something came near since the last update
+	std::vector<int> quietSteps; //per tile, updates since something last came near
+	std::vector<unsigned char> coarseBricks; //per pheromone brick, 1 while its tile is at soil resolution
+	std::vector<int> coarseList;
+};
@@ -0,0 +1,107 @@
+/*
+* Smoothed gradients of the two quantities agents steer by (what searching and what returning agents look for)
+* It is rebuilt every step, but only for the bricks that hold an agent, so the cost follows the occupied region and
+* agents sharing a brick share its work instead of each gathering their own samples
+*/
+#pragma once
+#include <glm/glm.hpp>
+#include <array>
+#include <vector>
+#include "VoxelGrid.h"
+#include "WorkerPool.h"
+
+struct SteeringGradient {
+	glm::vec3 searching = glm::vec3(0);
+	glm::vec3 returning = glm::vec3(0);
+};
+
+class GradientField {
+public:
+	//size the field for a grid and forget last step's bricks. Only allocates the first time
+	template <typename Voxel>
+	void prepare(VoxelGrid<Voxel>& grid) {
+		size_t volume = static_cast<size_t>(grid.getBrickCount()) * VoxelGrid<Voxel>::BRICK_VOLUME;
+		if (gradients.size() != volume) {
+			gradients.assign(volume, SteeringGradient());
+			active.assign(grid.getBrickCount(), 0);
+			activeBricks.reserve(grid.getBrickCount());
+		}
+		for (int brick : activeBricks)
+			active[brick] = 0;
+		activeBricks.clear();
+	}
+
+	//compute the brick this step
+	void activate(int brick) {
+		if (!active[brick]) {
+			active[brick] = 1;
+			activeBricks.push_back(brick);
+		}
+	}
+
+	/*
+	* sense(pos) returns the (searching, returning) values at a voxel position of the grid
+	* Each active brick reads its values plus a one voxel border once, then takes a 3x3x3 Sobel gradient, which is the central
+	* difference smoothed over the two other axes. Positions past the edge of the grid read the nearest voxel inside it
+	*/
+	template <typename Voxel, typename F>
+	void compute(VoxelGrid<Voxel>& grid, const F& sense) {
+		workerPool().parallelFor(activeBrickCount(), [&](int begin, int end, int thread) {
+			computeBricks(grid, sense, begin, end);
+		});
+	}
+
+	//compute active bricks [begin, end) only, for callers that schedule the bricks themselves
+	template <typename Voxel, typename F>
+	void computeBricks(VoxelGrid<Voxel>& grid, const F& sense, int begin, int end) {
+		const int B = VoxelGrid<Voxel>::BRICK_SIZE;
+		const int S = B + 2; //brick plus border
+		glm::vec3 dimensions = grid.getDimensions();
+		glm::ivec3 last = glm::ivec3(dimensions) - 1;
+
+		std::array<glm::vec2, S * S * S> values;
+		for (int b = begin; b < end; b++) {
+			int brick = activeBricks[b];
+			glm::ivec3 origin = glm::ivec3(grid.brickOrigin(brick));
+			for (int z = 0; z < S; z++)
+				for (int y = 0; y < S; y++)
+					for (int x = 0; x < S; x++) {
+						glm::ivec3 pos = glm::clamp(origin + glm::ivec3(x - 1, y - 1, z - 1), glm::ivec3(0), last);
+						values[x + S * (y + S * z)] = sense(glm::vec3(pos));
+					}
+
+			auto value = [&](int x, int y, int z) { return values[(x + 1) + S * ((y + 1) + S * (z + 1))]; };
+			const float smooth[3] = { 1, 2, 1 };
+			for (int z = 0; z < B; z++)
+				for (int y = 0; y < B; y++)
+					for (int x = 0; x < B; x++) {
+						glm::ivec3 pos = origin + glm::ivec3(x, y, z);
+						//brick padding past the edge of the grid has no gradient
+						if (pos.x > last.x || pos.y > last.y || pos.z > last.z)
+							continue;
+						glm::vec2 gx(0), gy(0), gz(0);
+						for (int a = -1; a <= 1; a++)
+							for (int c = -1; c <= 1; c++) {
+								float w = smooth[a + 1] * smooth[c + 1];
+								gx += w * (value(x + 1, y + a, z + c) - value(x - 1, y + a, z + c));
+								gy += w * (value(x + a, y + 1, z + c) - value(x + a, y - 1, z + c));
+								gz += w * (value(x + a, y + c, z + 1) - value(x + a, y + c, z - 1));
+							}
+						//the weights sum to 16 and the difference spans 2 voxels
+						SteeringGradient& gradient = gradients[grid.posToIndex(glm::vec3(pos))];
+						gradient.searching = glm::vec3(gx.x, gy.x, gz.x) / 32.f;
+						gradient.returning = glm::vec3(gx.y, gy.y, gz.y) / 32.f;
+					}
+		}
+	}
+
+	//the gradient at a voxel index of the grid, only valid for bricks that were active this step
+	const SteeringGradient& at(int index) const { return gradients[index]; }
+
+	int activeBrickCount() const { return static_cast<int>(activeBricks.size()); }
+
+private:
+	std::vector<SteeringGradient> gradients;
+	std::vector<unsigned char> active;
+	std::vector<int> activeBricks;
+};
@@ -0,0 +1,288 @@
+/*
+* Backing memory for VoxelGrid data
+* A grid either owns a plain heap allocation or maps a world file from disk. Mapped grids can be larger than RAM,
+* the OS pages bricks in and out as they are used and advise() lets the grid hint which ranges should stay resident
+* A new world file gets its header only once its voxels are written and flushed (markComplete), a file without one was left
+* behind part way through and is filled again instead of being loaded
+*/
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <utility>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+//describes the grid stored in a world file so a mismatched file is never mapped as voxel data
+struct WorldFileHeader {
+	char magic[8];
+	std::uint32_t elementSize;
+	std::uint32_t brickSize;
+	std::int32_t x_length;
+	std::int32_t y_length;
+	std::int32_t z_length;
+};
+
+//how a heap backed grid is allocated
+struct GridAllocation {
+	std::size_t alignment = 64; //cache line aligned so SIMD loads of a brick never straddle an extra line
+	bool hugePages = false; //2MB aligned and backed by transparent huge pages so large sweeps take fewer TLB misses
+};
+
+class GridStorage {
+public:
+	enum Policy { HEAP, MAPPED };
+
+	//the header is padded to a page so the voxel data (and therefore every brick) starts page aligned
+	static const std::size_t WORLD_HEADER_BYTES = 4096;
+
+	static const std::size_t HUGE_PAGE_BYTES = 2 * 1024 * 1024;
+
+	static GridStorage heap(std::size_t bytes, GridAllocation allocation = GridAllocation());
+	//maps the voxel data of a world file, creating the file if it does not exist yet or was never completed
+	static GridStorage mapped(const std::string& path, const WorldFileHeader& header, std::size_t bytes);
+
+	GridStorage(const GridStorage&) = delete;
+	GridStorage& operator=(const GridStorage&) = delete;
+	GridStorage(GridStorage&& other) noexcept;
+	GridStorage& operator=(GridStorage&& other) noexcept;
+	~GridStorage();
+
+	void* data() { return voxels; }
+	std::size_t size() const { return bytes; }
+	Policy policy() const { return storagePolicy; }
+	//true if the voxel data was read from an existing world file rather than freshly allocated
+	bool loadedFromFile() const { return existed; }
+	//the voxel data of a world file is all written: flush it, then write and flush the header that makes the file loadable
+	//does nothing for heap storage
+	void markComplete();
+
+	//hint that a byte range of the voxel data will (or will not) be used soon. Only meaningful for mapped storage
+	void advise(std::size_t offset, std::size_t length, bool willNeed);
+	//advise brick ordered voxel data brick by brick: bricks flagged in active will be needed, the rest may be dropped
+	void adviseBricks(const unsigned char* active, int brickCount, std::size_t brickBytes);
+
+private:
+	GridStorage() = default;
+	void release();
+
+	Policy storagePolicy = HEAP;
+	void* voxels = nullptr;
+	std::size_t bytes = 0;
+	std::size_t alignment = 0;
+	bool existed = false;
+	WorldFileHeader header = {}; //written to a new world file by markComplete
+
+	//mapped storage keeps the whole view (header included) so it can be unmapped
+	void* view = nullptr;
+	std::size_t viewBytes = 0;
+#ifdef _WIN32
+	HANDLE file = INVALID_HANDLE_VALUE;
+	HANDLE mapping = NULL;
+#endif
+};
+
+//definitions
+
+inline GridStorage GridStorage::heap(std::size_t _bytes, GridAllocation allocation) {
+	GridStorage storage;
+	storage.storagePolicy = HEAP;
+	storage.alignment = allocation.hugePages ? std::max(allocation.alignment, HUGE_PAGE_BYTES) : allocation.alignment;
+	storage.bytes = _bytes;
+	if (allocation.hugePages) //round up so the last huge page is not shared with other allocations
+		_bytes = (_bytes + HUGE_PAGE_BYTES - 1) / HUGE_PAGE_BYTES * HUGE_PAGE_BYTES;
+	storage.voxels = ::operator new(_bytes, std::align_val_t(storage.alignment));
+#if defined(MADV_HUGEPAGE)
+	//only a hint, the kernel falls back to normal pages if transparent huge pages are disabled
+	if (allocation.hugePages)
+		madvise(storage.voxels, _bytes, MADV_HUGEPAGE);
+#endif
+	//on windows large pages need the lock memory privilege, the grid just gets the 2MB alignment there
+	return storage;
+}
+
+inline GridStorage GridStorage::mapped(const std::string& path, const WorldFileHeader& header, std::size_t _bytes) {
+	GridStorage storage;
+	storage.storagePolicy = MAPPED;
+	storage.bytes = _bytes;
+	storage.viewBytes = WORLD_HEADER_BYTES + _bytes;
+
+#ifdef _WIN32
+	storage.file = CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE, 0, NULL, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (storage.file == INVALID_HANDLE_VALUE)
+		throw std::runtime_error("could not open world file " + path);
+	storage.existed = GetLastError() == ERROR_ALREADY_EXISTS;
+	LARGE_INTEGER fileSize;
+	GetFileSizeEx(storage.file, &fileSize);
+	if (storage.existed && static_cast<std::size_t>(fileSize.QuadPart) != storage.viewBytes)
+		throw std::runtime_error("world file " + path + " does not match the grid size");
+	LARGE_INTEGER mappingSize;
+	mappingSize.QuadPart = storage.viewBytes;
+	storage.mapping = CreateFileMappingA(storage.file, NULL, PAGE_READWRITE, mappingSize.HighPart, mappingSize.LowPart, NULL);
+	if (storage.mapping == NULL)
+		throw std::runtime_error("could not map world file " + path);
+	storage.view = MapViewOfFile(storage.mapping, FILE_MAP_ALL_ACCESS, 0, 0, storage.viewBytes);
+	if (storage.view == nullptr)
+		throw std::runtime_error("could not map world file " + path);
+#else
+	int fd = open(path.c_str(), O_RDWR | O_CREAT, 0644);
+	if (fd < 0)
+		throw std::runtime_error("could not open world file " + path);
+	struct stat fileInfo;
+	fstat(fd, &fileInfo);
+	storage.existed = fileInfo.st_size > 0;
+	if (storage.existed && static_cast<std::size_t>(fileInfo.st_size) != storage.viewBytes) {
+		close(fd);
+		throw std::runtime_error("world file " + path + " does not match the grid size");
+	}
+	if (!storage.existed && ftruncate(fd, storage.viewBytes) != 0) {
+		close(fd);
+		throw std::runtime_error("could not size world file " + path);
+	}
+	storage.view = mmap(nullptr, storage.viewBytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd); //the mapping keeps its own reference to the file
+	if (storage.view == MAP_FAILED) {
+		storage.view = nullptr;
+		throw std::runtime_error("could not map world file " + path);
+	}
+#endif
+
+	storage.header = header;
+	storage.voxels = static_cast<char*>(storage.view) + WORLD_HEADER_BYTES;
+	if (storage.existed) {
+		const WorldFileHeader unwritten = {};
+		if (std::memcmp(storage.view, &unwritten, sizeof(WorldFileHeader)) == 0)
+			storage.existed = false; //created but never completed, the caller fills it again
+		else if (std::memcmp(storage.view, &header, sizeof(WorldFileHeader)) != 0)
+			throw std::runtime_error("world file " + path + " was written for a different grid");
+	}
+	return storage;
+}
+
+inline GridStorage::GridStorage(GridStorage&& other) noexcept {
+	*this = std::move(other);
+}
+
+inline GridStorage& GridStorage::operator=(GridStorage&& other) noexcept {
+	if (this == &other)
+		return *this;
+	release();
+	storagePolicy = other.storagePolicy;
+	voxels = other.voxels;
+	bytes = other.bytes;
+	alignment = other.alignment;
+	existed = other.existed;
+	header = other.header;
+	view = other.view;
+	viewBytes = other.viewBytes;
+	other.voxels = nullptr;
+	other.view = nullptr;
+#ifdef _WIN32
+	file = other.file;
+	mapping = other.mapping;
+	other.file = INVALID_HANDLE_VALUE;
+	other.mapping = NULL;
+#endif
+	return *this;
+}
+
+inline GridStorage::~GridStorage() {
+	release();
+}
+
+inline void GridStorage::release() {
+	if (storagePolicy == HEAP) {
+		if (voxels != nullptr)
+			::operator delete(voxels, std::align_val_t(alignment));
+	}
+	else {
+#ifdef _WIN32
+		if (view != nullptr)
+			UnmapViewOfFile(view);
+		if (mapping != NULL)
+			CloseHandle(mapping);
+		if (file != INVALID_HANDLE_VALUE)
+			CloseHandle(file);
+		mapping = NULL;
+		file = INVALID_HANDLE_VALUE;
+#else
+		if (view != nullptr)
+			munmap(view, viewBytes);
+#endif
+	}
+	voxels = nullptr;
+	view = nullptr;
+}
+
+inline void GridStorage::markComplete() {
+	if (storagePolicy != MAPPED)
+		return;
+#ifdef _WIN32
+	FlushViewOfFile(view, viewBytes);
+	FlushFileBuffers(file);
+	std::memcpy(view, &header, sizeof(WorldFileHeader));
+	FlushViewOfFile(view, sizeof(WorldFileHeader));
+	FlushFileBuffers(file);
+#else
+	//the data reaches the disk before the header does, so a crash in between leaves a file that is filled again
+	msync(view, viewBytes, MS_SYNC);
+	std::memcpy(view, &header, sizeof(WorldFileHeader));
+	msync(view, WORLD_HEADER_BYTES, MS_SYNC);
+#endif
+}
+
+inline void GridStorage::adviseBricks(const unsigned char* active, int brickCount, std::size_t brickBytes) {
+	if (storagePolicy != MAPPED)
+		return;
+	//coalesce runs of bricks with the same state so each run is a single hint
+	int runStart = 0;
+	for (int brick = 1; brick <= brickCount; brick++) {
+		if (brick < brickCount && active[brick] == active[runStart])
+			continue;
+		advise(brickBytes * runStart, brickBytes * (brick - runStart), active[runStart] != 0);
+		runStart = brick;
+	}
+}
+
+inline void GridStorage::advise(std::size_t offset, std::size_t length, bool willNeed) {
+	if (storagePolicy != MAPPED || length == 0)
+		return;
+#ifdef _WIN32
+	//windows has no equivalent of dropping clean pages from a view, only prefetching is hinted
+	if (willNeed) {
+		WIN32_MEMORY_RANGE_ENTRY range;
+		range.VirtualAddress = static_cast<char*>(voxels) + offset;
+		range.NumberOfBytes = length;
+		PrefetchVirtualMemory(GetCurrentProcess(), 1, &range, 0);
+	}
+#else
+	static const std::uintptr_t pageSize = sysconf(_SC_PAGESIZE);
+	//prefetching rounds outwards, evicting rounds inwards so a page shared with a neighbouring brick that is still in use is never dropped
+	std::uintptr_t first = reinterpret_cast<std::uintptr_t>(voxels) + offset;
+	std::uintptr_t last = first + length;
+	std::uintptr_t begin = willNeed ? first / pageSize * pageSize : (first + pageSize - 1) / pageSize * pageSize;
+	std::uintptr_t end = willNeed ? (last + pageSize - 1) / pageSize * pageSize : last / pageSize * pageSize;
+	begin = std::max(begin, reinterpret_cast<std::uintptr_t>(view));
+	end = std::min(end, reinterpret_cast<std::uintptr_t>(view) + viewBytes);
+	if (end <= begin)
+		return;
+	madvise(reinterpret_cast<void*>(begin), end - begin, willNeed ? MADV_WILLNEED : MADV_DONTNEED);
+#endif
+}
@@ -0,0 +1,81 @@
+/*
+* Morton (Z-order) codes and a parallel radix sort to order things by them
+* Interleaving the bits of x, y and z gives a code where points that are close in the grid are mostly close in the order,
+* so walking a list sorted by code walks the grid brick by brick
+*/
+#pragma once
+#include <glm/glm.hpp>
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <utility>
+#include "settings.h"
+#include "WorkerPool.h"
+
+//spread the low 10 bits of v so there are two zero bits between each of them
+inline std::uint32_t spreadBits(std::uint32_t v) {
+	v &= 0x3ff;
+	v = (v | (v << 16)) & 0x030000ff;
+	v = (v | (v << 8)) & 0x0300f00f;
+	v = (v | (v << 4)) & 0x030c30c3;
+	v = (v | (v << 2)) & 0x09249249;
+	return v;
+}
+
+//Morton code of a voxel with coordinates below 1024
+inline std::uint32_t mortonCode(glm::ivec3 voxel) {
+	return spreadBits(voxel.x) | (spreadBits(voxel.y) << 1) | (spreadBits(voxel.z) << 2);
+}
+
+/*
+* Stable least significant digit radix sort of count keys, each carrying a value, 8 bits per pass
+* Only as many passes as maxKey needs are made. Every pass splits the input into one block per pool thread: each block
+* counts its digits, the counts are prefix summed in (digit, block) order, then each block scatters its keys, which keeps it stable
+* The scratch arrays must hold count entries. The sorted result is left in keys and values
+*/
+inline void radixSort(std::uint32_t* keys, int* values, std::uint32_t* keyScratch, int* valueScratch, int count, std::uint32_t maxKey) {
+	const int blocks = workerPool().size();
+	std::array<std::array<int, 256>, NUMBER_WORKER_THREADS> offsets;
+	std::uint32_t* from = keys;
+	std::uint32_t* to = keyScratch;
+	int* fromValues = values;
+	int* toValues = valueScratch;
+	int blockSize = (count + blocks - 1) / blocks;
+
+	for (int shift = 0; shift < 32 && (maxKey >> shift) != 0; shift += 8) {
+		workerPool().parallelFor(blocks, [&](int begin, int end, int thread) {
+			for (int block = begin; block < end; block++) {
+				offsets[block].fill(0);
+				int last = std::min(count, (block + 1) * blockSize);
+				for (int i = block * blockSize; i < last; i++)
+					offsets[block][(from[i] >> shift) & 0xff]++;
+			}
+		});
+		int total = 0;
+		for (int digit = 0; digit < 256; digit++)
+			for (int block = 0; block < blocks; block++) {
+				int blockCount = offsets[block][digit];
+				offsets[block][digit] = total;
+				total += blockCount;
+			}
+		workerPool().parallelFor(blocks, [&](int begin, int end, int thread) {
+			for (int block = begin; block < end; block++) {
+				int last = std::min(count, (block + 1) * blockSize);
+				for (int i = block * blockSize; i < last; i++) {
+					int destination = offsets[block][(from[i] >> shift) & 0xff]++;
+					to[destination] = from[i];
+					toValues[destination] = fromValues[i];
+				}
+			}
+		});
+		std::swap(from, to);
+		std::swap(fromValues, toValues);
+	}
+
+	//an odd number of passes leaves the result in the scratch arrays
+	if (from != keys) {
+		std::memcpy(keys, from, sizeof(std::uint32_t) * count);
+		std::memcpy(values, fromValues, sizeof(int) * count);
+	}
+}
@@ -0,0 +1,170 @@
+/*
+* Conversions and transfer kernels between the soil grid and the finer pheromone grid
+* Every soil voxel is split into PHEROMONE_RESOLUTION^3 pheromone voxels. Pheromone voxel p lies in soil voxel floor(p / 3),
+* soil voxel s covers the pheromone voxels [3s, 3s + 2] and its centre is the pheromone voxel 3s + 1
+*/
+#pragma once
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <vector>
+#include "settings.h"
+#include "VoxelGrid.h"
+#include "WorkerPool.h"
+#include "soil.h"
+
+const int PHEROMONE_RESOLUTION = 3;
+
+//size of the pheromone grid along each axis
+inline glm::vec3 pheromoneGridDimensions() {
+	return glm::vec3(SOIL_X_LENGTH, SOIL_Y_LENGTH, SOIL_Z_LENGTH) * float(PHEROMONE_RESOLUTION);
+}
+
+//true if a (possibly fractional) pheromone position lies inside the pheromone grid
+inline bool inPheromoneGrid(glm::vec3 pheromonePos) {
+	glm::vec3 dimensions = pheromoneGridDimensions();
+	return pheromonePos.x >= 0 && pheromonePos.x < dimensions.x
+		&& pheromonePos.y >= 0 && pheromonePos.y < dimensions.y
+		&& pheromonePos.z >= 0 && pheromonePos.z < dimensions.z;
+}
+
+//the soil voxel a pheromone position lies in
+inline glm::vec3 soilCellOf(glm::vec3 pheromonePos) {
+	return glm::floor(pheromonePos / float(PHEROMONE_RESOLUTION));
+}
+
+//the pheromone voxel at the centre of a soil voxel
+inline glm::vec3 soilCellCentre(glm::vec3 soilPos) {
+	return soilPos * float(PHEROMONE_RESOLUTION) + glm::vec3(PHEROMONE_RESOLUTION / 2);
+}
+
+//model matrix that draws a unit cube over a pheromone voxel in soil (world) units
+inline glm::mat4 pheromoneCellTransform(glm::vec3 pheromonePos) {
+	return glm::translate(glm::mat4(1), (pheromonePos - glm::vec3(PHEROMONE_RESOLUTION / 2)) / float(PHEROMONE_RESOLUTION))
+		* glm::scale(glm::mat4(1), glm::vec3(1.f / PHEROMONE_RESOLUTION));
+}
+
+enum class RestrictionOp { AVERAGE, MAXIMUM };
+
+/*
+* Restriction: reduce every PHEROMONE_RESOLUTION^3 block of pheromone voxels to one voxel of a soil resolution grid
+* Only reads the fine grid (no occupancy or residency marking) and writes every coarse voxel, so it can run while nothing else writes the fine grid
+* Coarse z slabs are handed to the worker pool. The fine indices of a block are put together from per axis offsets worked out once
+* per slab, row and cell, and the reduction is a template parameter so the innermost loop is only the channels
+* Voxel is PheromoneVoxel, it is a template parameter so this file does not depend on Pheromones.h (which uses the conversions above)
+* Only the coarse voxels in [cellMin, cellMax) are written, the overload without a range does the whole coarse grid
+*/
+template <RestrictionOp Op, typename Voxel>
+void restrictPheromones(VoxelGrid<Voxel>& pheromones, VoxelGrid<Voxel>& coarse, glm::ivec3 cellMin, glm::ivec3 cellMax) {
+	const float blockWeight = 1.f / (PHEROMONE_RESOLUTION * PHEROMONE_RESOLUTION * PHEROMONE_RESOLUTION);
+	const Voxel* fine = pheromones.voxels();
+
+	workerPool().parallelFor(cellMax.z - cellMin.z, [&](int zBegin, int zEnd, int thread) {
+		for (int z = cellMin.z + zBegin; z < cellMin.z + zEnd; z++) {
+			std::array<int, PHEROMONE_RESOLUTION> zOffsets;
+			for (int d = 0; d < PHEROMONE_RESOLUTION; d++)
+				zOffsets[d] = pheromones.zOffset(z * PHEROMONE_RESOLUTION + d);
+			for (int y = cellMin.y; y < cellMax.y; y++) {
+				std::array<int, PHEROMONE_RESOLUTION * PHEROMONE_RESOLUTION> yzOffsets;
+				for (int dz = 0; dz < PHEROMONE_RESOLUTION; dz++)
+					for (int dy = 0; dy < PHEROMONE_RESOLUTION; dy++)
+						yzOffsets[dz * PHEROMONE_RESOLUTION + dy] = zOffsets[dz] + pheromones.yOffset(y * PHEROMONE_RESOLUTION + dy);
+				const int coarseRow = coarse.zOffset(z) + coarse.yOffset(y);
+				for (int x = cellMin.x; x < cellMax.x; x++) {
+					std::array<int, PHEROMONE_RESOLUTION> xOffsets;
+					for (int d = 0; d < PHEROMONE_RESOLUTION; d++)
+						xOffsets[d] = pheromones.xOffset(x * PHEROMONE_RESOLUTION + d);
+					float reduced[Voxel::NUMBER_OF_PHEROMONES] = {};
+					for (int yz : yzOffsets) {
+						for (int dx : xOffsets) {
+							const Voxel& voxel = fine[yz + dx];
+							for (int i = 0; i < Voxel::NUMBER_OF_PHEROMONES; i++)
+								reduced[i] = Op == RestrictionOp::AVERAGE ? reduced[i] + voxel.pheromones[i] : std::max(reduced[i], voxel.pheromones[i]);
+						}
+					}
+					Voxel& target = coarse.peek(coarseRow + coarse.xOffset(x));
+					for (int i = 0; i < Voxel::NUMBER_OF_PHEROMONES; i++)
+						target.pheromones[i] = Op == RestrictionOp::AVERAGE ? reduced[i] * blockWeight : reduced[i];
+				}
+			}
+		}
+	});
+}
+
+template <typename Voxel>
+void restrictPheromones(VoxelGrid<Voxel>& pheromones, VoxelGrid<Voxel>& coarse, RestrictionOp op, glm::ivec3 cellMin, glm::ivec3 cellMax) {
+	if (op == RestrictionOp::AVERAGE)
+		restrictPheromones<RestrictionOp::AVERAGE>(pheromones, coarse, cellMin, cellMax);
+	else
+		restrictPheromones<RestrictionOp::MAXIMUM>(pheromones, coarse, cellMin, cellMax);
+}
+
+template <typename Voxel>
+void restrictPheromones(VoxelGrid<Voxel>& pheromones, VoxelGrid<Voxel>& coarse, RestrictionOp op) {
+	restrictPheromones(pheromones, coarse, op, glm::ivec3(0), glm::ivec3(coarse.getDimensions()));
+}
+
+/*
+* Prolongation: expand the soil occupancy to pheromone resolution
+* mask is indexed like the pheromone grid (posToIndex) and holds 1 where the pheromone voxel is open (not inside soil)
+*/
+template <typename Voxel>
+void prolongOpenMask(SoilGrid& soil, VoxelGrid<Voxel>& pheromones, std::vector<std::uint8_t>& mask) {
+	mask.assign(static_cast<size_t>(pheromones.getBrickCount()) * VoxelGrid<Voxel>::BRICK_VOLUME, 0);
+	glm::vec3 soilDimensions = soil.getDimensions();
+	const int sx = soilDimensions.x, sy = soilDimensions.y, sz = soilDimensions.z;
+
+	workerPool().parallelFor(sz, [&](int zBegin, int zEnd, int thread) {
+		for (int z = zBegin; z < zEnd; z++) {
+			for (int y = 0; y < sy; y++) {
+				for (int x = 0; x < sx; x++) {
+					//one bit read per soil voxel, broadcast to its whole block
+					std::uint8_t open = soil.isSoil(x, y, z) ? 0 : 1;
+					for (int dz = 0; dz < PHEROMONE_RESOLUTION; dz++)
+						for (int dy = 0; dy < PHEROMONE_RESOLUTION; dy++)
+							for (int dx = 0; dx < PHEROMONE_RESOLUTION; dx++)
+								mask[pheromones.posToIndex(glm::vec3(x * PHEROMONE_RESOLUTION + dx, y * PHEROMONE_RESOLUTION + dy, z * PHEROMONE_RESOLUTION + dz))] = open;
+				}
+			}
+		}
+	});
+}
+
+/*
+* Prolongation of values: write the coarse voxels in [cellMin, cellMax) back to their blocks of pheromone voxels
+* The pattern a block already holds is kept and scaled so the block averages to its coarse voxel again, a block that holds
+* nothing of a channel gets the coarse value everywhere. Either way the block sums to exactly the coarse voxel's share
+* Blocks that end up with pheromone are written through at() so they are marked occupied, which is not thread safe, so this
+* runs on the calling thread. It is meant for small regions
+*/
+template <typename Voxel>
+void prolongPheromones(VoxelGrid<Voxel>& coarse, VoxelGrid<Voxel>& pheromones, glm::ivec3 cellMin, glm::ivec3 cellMax) {
+	const int blockVolume = PHEROMONE_RESOLUTION * PHEROMONE_RESOLUTION * PHEROMONE_RESOLUTION;
+	for (int z = cellMin.z; z < cellMax.z; z++) {
+		for (int y = cellMin.y; y < cellMax.y; y++) {
+			for (int x = cellMin.x; x < cellMax.x; x++) {
+				std::array<int, blockVolume> block;
+				float sums[Voxel::NUMBER_OF_PHEROMONES] = {};
+				for (int b = 0; b < blockVolume; b++) {
+					glm::vec3 fine(x * PHEROMONE_RESOLUTION + b % PHEROMONE_RESOLUTION, y * PHEROMONE_RESOLUTION + b / PHEROMONE_RESOLUTION % PHEROMONE_RESOLUTION, z * PHEROMONE_RESOLUTION + b / (PHEROMONE_RESOLUTION * PHEROMONE_RESOLUTION));
+					block[b] = pheromones.posToIndex(fine);
+					for (int i = 0; i < Voxel::NUMBER_OF_PHEROMONES; i++)
+						sums[i] += pheromones.peek(block[b]).pheromones[i];
+				}
+				const Voxel& value = coarse.peek(coarse.posToIndex(glm::vec3(x, y, z)));
+				bool empty = true;
+				for (int i = 0; i < Voxel::NUMBER_OF_PHEROMONES; i++)
+					empty = empty && value.pheromones[i] == 0;
+				for (int b = 0; b < blockVolume; b++) {
+					Voxel& voxel = empty ? pheromones.peek(block[b]) : pheromones.at(block[b]);
+					for (int i = 0; i < Voxel::NUMBER_OF_PHEROMONES; i++) {
+						float& pheromone = voxel.pheromones[i];
+						pheromone = sums[i] > 0 ? pheromone * (value.pheromones[i] * blockVolume / sums[i]) : value.pheromones[i];
+					}
+				}
+			}
+		}
+	}
+}
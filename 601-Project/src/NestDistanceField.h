@@ -0,0 +1,106 @@
+/*
+* The number of soil voxel steps from every open soil voxel to the nest, going around soil (a breadth first search over 6 neighbours)
+* Soil is only ever removed, which can only shorten paths, so a depleted voxel is handled by lowering distances outwards from it
+* instead of searching the whole grid again
+*/
+#pragma once
+#include <glm/glm.hpp>
+#include <algorithm>
+#include <array>
+#include <limits>
+#include <vector>
+#include "soil.h"
+
+class NestDistanceField {
+public:
+	static constexpr int UNREACHABLE = std::numeric_limits<int>::max();
+
+	//search from the open soil voxels in [nestMin, nestMax]. Only allocates the first time
+	void build(SoilGrid& soil, glm::ivec3 nestMin, glm::ivec3 nestMax) {
+		dimensions = glm::ivec3(soil.getDimensions());
+		distances.assign(dimensions.x * dimensions.y * dimensions.z, UNREACHABLE);
+		queue.reserve(distances.size());
+		queue.clear();
+		for (int z = nestMin.z; z <= nestMax.z; z++)
+			for (int y = nestMin.y; y <= nestMax.y; y++)
+				for (int x = nestMin.x; x <= nestMax.x; x++) {
+					if (soil.isSoil(x, y, z))
+						continue;
+					distances[index(glm::ivec3(x, y, z))] = 0;
+					queue.push_back(index(glm::ivec3(x, y, z)));
+				}
+		propagate(soil);
+		built = true;
+	}
+
+	bool isBuilt() const { return built; }
+
+	//a soil voxel was removed: give it a distance through its open neighbours and pass any shortcut it opens on
+	void opened(SoilGrid& soil, glm::ivec3 cell) {
+		int best = UNREACHABLE;
+		for (glm::ivec3 offset : neighbourOffsets()) {
+			glm::ivec3 neighbour = cell + offset;
+			if (!soil.isSoil(neighbour.x, neighbour.y, neighbour.z))
+				best = std::min(best, distances[index(neighbour)]);
+		}
+		if (best == UNREACHABLE || best + 1 >= distances[index(cell)])
+			return;
+		distances[index(cell)] = best + 1;
+		queue.clear();
+		queue.push_back(index(cell));
+		propagate(soil);
+	}
+
+	//distance of a soil voxel, UNREACHABLE for soil and for open voxels cut off from the nest
+	int distance(glm::ivec3 cell) const {
+		if (cell.x < 0 || cell.y < 0 || cell.z < 0 || cell.x >= dimensions.x || cell.y >= dimensions.y || cell.z >= dimensions.z)
+			return UNREACHABLE;
+		return distances[index(cell)];
+	}
+
+	//unit step towards the neighbour closest to the nest, or 0 when the voxel is at the nest or cut off from it
+	glm::vec3 downhill(glm::ivec3 cell) const {
+		int best = distance(cell);
+		glm::vec3 step(0);
+		for (glm::ivec3 offset : neighbourOffsets()) {
+			int d = distance(cell + offset);
+			if (d < best) {
+				best = d;
+				step = glm::vec3(offset);
+			}
+		}
+		return step;
+	}
+
+private:
+	static const std::array<glm::ivec3, 6>& neighbourOffsets() {
+		static const std::array<glm::ivec3, 6> offsets = { glm::ivec3(1, 0, 0), glm::ivec3(-1, 0, 0), glm::ivec3(0, 1, 0),
+			glm::ivec3(0, -1, 0), glm::ivec3(0, 0, 1), glm::ivec3(0, 0, -1) };
+		return offsets;
+	}
+
+	int index(glm::ivec3 cell) const { return cell.x + dimensions.x * (cell.y + dimensions.y * cell.z); }
+
+	//lower distances outwards from the voxels in the queue until nothing improves
+	void propagate(SoilGrid& soil) {
+		for (size_t head = 0; head < queue.size(); head++) {
+			int current = queue[head];
+			glm::ivec3 cell(current % dimensions.x, (current / dimensions.x) % dimensions.y, current / (dimensions.x * dimensions.y));
+			int next = distances[current] + 1;
+			for (glm::ivec3 offset : neighbourOffsets()) {
+				glm::ivec3 neighbour = cell + offset;
+				//isSoil is true outside the grid
+				if (soil.isSoil(neighbour.x, neighbour.y, neighbour.z) || distances[index(neighbour)] <= next)
+					continue;
+				distances[index(neighbour)] = next;
+				queue.push_back(index(neighbour));
+			}
+		}
+		queue.clear();
+	}
+
+	glm::ivec3 dimensions = glm::ivec3(0);
+	std::vector<int> distances;
+	std::vector<int> queue; //indices whose distance dropped and still need to be passed on
+	bool built = false;
+};
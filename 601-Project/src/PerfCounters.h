@@ -0,0 +1,104 @@
+/*
+* Hardware counters used to profile the simulation step
+* Only linux exposes them (through perf_event_open), elsewhere the counters report as unavailable
+*/
+#pragma once
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+//counts data TLB load misses of the thread that created it and of the given other threads (linux thread ids, such as the
+//worker pool's), summed. A counter only follows the thread it was opened for, so each thread gets its own
+class TlbMissCounter {
+public:
+	explicit TlbMissCounter(const std::vector<int>& otherThreads = {});
+	~TlbMissCounter();
+	TlbMissCounter(const TlbMissCounter&) = delete;
+	TlbMissCounter& operator=(const TlbMissCounter&) = delete;
+
+	bool isAvailable() const { return !fds.empty(); }
+	void start();
+	//returns the misses of all the threads since start(), or -1 if the counter is not available
+	long long stop();
+
+private:
+	std::vector<int> fds;
+};
+
+//definitions
+
+#if defined(__linux__)
+//0 opens the counter for the calling thread
+inline int openTlbMissCounter(int thread) {
+	perf_event_attr attributes;
+	std::memset(&attributes, 0, sizeof(attributes));
+	attributes.size = sizeof(attributes);
+	attributes.type = PERF_TYPE_HW_CACHE;
+	attributes.config = PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+	attributes.disabled = 1;
+	attributes.exclude_kernel = 1;
+	attributes.exclude_hv = 1;
+	return static_cast<int>(syscall(SYS_perf_event_open, &attributes, thread, -1, -1, 0));
+}
+#endif
+
+inline TlbMissCounter::TlbMissCounter(const std::vector<int>& otherThreads) {
+#if defined(__linux__)
+	//fails when the kernel does not allow user space profiling (perf_event_paranoid), the counter then stays unavailable
+	//rather than reporting part of the threads
+	fds.push_back(openTlbMissCounter(0));
+	for (int thread : otherThreads)
+		fds.push_back(thread >= 0 ? openTlbMissCounter(thread) : -1);
+	for (int fd : fds) {
+		if (fd < 0) {
+			for (int open : fds) {
+				if (open >= 0)
+					close(open);
+			}
+			fds.clear();
+			break;
+		}
+	}
+#endif
+}
+
+inline TlbMissCounter::~TlbMissCounter() {
+#if defined(__linux__)
+	for (int fd : fds)
+		close(fd);
+#endif
+}
+
+inline void TlbMissCounter::start() {
+#if defined(__linux__)
+	for (int fd : fds) {
+		ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+		ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+	}
+#endif
+}
+
+inline long long TlbMissCounter::stop() {
+#if defined(__linux__)
+	if (fds.empty())
+		return -1;
+	long long total = 0;
+	for (int fd : fds) {
+		ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+		std::uint64_t count = 0;
+		if (read(fd, &count, sizeof(count)) != sizeof(count))
+			return -1;
+		total += static_cast<long long>(count);
+	}
+	return total;
+#else
+	return -1;
+#endif
+}
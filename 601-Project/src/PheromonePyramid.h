@@ -0,0 +1,197 @@
+/*
+* A mip pyramid of the pheromone grid, so agents can sense what lies further away than their sensors reach with a few reads
+* Level l holds the (wander, food, root) average of 2^l pheromone voxels along each axis, level 0 being the grid itself
+* Levels 1 to 3 fit inside a brick (8 = 2^3), so each brick that changed rebuilds its own cells of them, bricks in parallel. The
+* levels above only redo the parents of the cells that changed. Cells past the edge of the grid are left out of the averages, and
+* a cell at the edge weighs its children by how many grid voxels they cover, so it is still the average of its voxels
+*/
+#pragma once
+#include <glm/glm.hpp>
+#include <vector>
+#include "VoxelGrid.h"
+
+template <typename Voxel>
+class PheromonePyramid {
+	static_assert(Voxel::NUMBER_OF_PHEROMONES == 3, "the pyramid keeps the channels as a vec3");
+public:
+	static const int BRICK_LEVELS = 3; //levels that fit inside a brick
+	static_assert(VoxelGrid<Voxel>::BRICK_SIZE == 1 << BRICK_LEVELS, "the brick levels assume 8^3 bricks");
+
+	//size the levels for a grid, only allocates the first time. Every brick starts out changed so the first rebuild is complete
+	void prepare(VoxelGrid<Voxel>& grid) {
+		if (!levels.empty())
+			return;
+		const int B = VoxelGrid<Voxel>::BRICK_SIZE;
+		dimensions = glm::ivec3(grid.getDimensions());
+		bricks = (dimensions + B - 1) / B;
+		brickChanged.assign(grid.getBrickCount(), 1);
+		changedBricks.reserve(grid.getBrickCount());
+		glm::ivec3 size = dimensions;
+		do {
+			size = (size + 1) / 2;
+			Level level;
+			level.size = size;
+			size_t volume = static_cast<size_t>(size.x) * size.y * size.z;
+			level.values.assign(volume, glm::vec3(0));
+			level.queued.assign(volume, 0);
+			level.changed.reserve(volume);
+			levels.push_back(std::move(level));
+		} while (size != glm::ivec3(1));
+	}
+
+	//the brick's voxels were written, it is rebuilt next time
+	void markChanged(int brick) {
+		if (!brickChanged.empty())
+			brickChanged[brick] = 1;
+	}
+
+	//take the bricks that changed since the last rebuild, returns how many there are for rebuildBricks
+	int beginRebuild() {
+		changedBricks.clear();
+		for (int brick = 0; brick < static_cast<int>(brickChanged.size()); brick++) {
+			if (brickChanged[brick]) {
+				brickChanged[brick] = 0;
+				changedBricks.push_back(brick);
+			}
+		}
+		return static_cast<int>(changedBricks.size());
+	}
+
+	/*
+	* Rebuild the brick levels of changed bricks [begin, end), bricks can be handed to different threads
+	* Bricks for which isCoarse(brick) is true take their level 1 cells from coarseValue(pheromone position) instead of their voxels
+	*/
+	template <typename F, typename G>
+	void rebuildBricks(VoxelGrid<Voxel>& grid, int begin, int end, const F& isCoarse, const G& coarseValue) {
+		const int B = VoxelGrid<Voxel>::BRICK_SIZE;
+		const Voxel* voxels = grid.voxels();
+		for (int b = begin; b < end; b++) {
+			int brick = changedBricks[b];
+			glm::ivec3 brickCell(brick % bricks.x, (brick / bricks.x) % bricks.y, brick / (bricks.x * bricks.y));
+			bool coarse = isCoarse(brick);
+			const Voxel* brickVoxels = voxels + static_cast<size_t>(brick) * VoxelGrid<Voxel>::BRICK_VOLUME;
+			for (int level = 1; level <= BRICK_LEVELS; level++) {
+				const int span = B >> level; //cells of this level along a brick
+				Level& target = levels[level - 1];
+				glm::ivec3 origin = brickCell * span;
+				for (int z = 0; z < span; z++)
+					for (int y = 0; y < span; y++)
+						for (int x = 0; x < span; x++) {
+							glm::ivec3 cell = origin + glm::ivec3(x, y, z);
+							if (glm::any(glm::greaterThanEqual(cell, target.size)))
+								continue;
+							glm::vec3 sum(0);
+							int count = 0;
+							if (level == 1 && coarse) {
+								sum = coarseValue(glm::vec3(cell * 2 + 1));
+								count = 1;
+							}
+							else if (level == 1) {
+								for (int c = 0; c < 8; c++) {
+									glm::ivec3 local = glm::ivec3(x, y, z) * 2 + glm::ivec3(c & 1, (c >> 1) & 1, c >> 2);
+									if (glm::any(glm::greaterThanEqual(brickCell * B + local, dimensions)))
+										continue;
+									const Voxel& voxel = brickVoxels[(local.z * B + local.y) * B + local.x];
+									sum += glm::vec3(voxel.pheromones[0], voxel.pheromones[1], voxel.pheromones[2]);
+									count++;
+								}
+							}
+							else
+								sum = sumChildren(level, cell, count);
+							target.values[index(target, cell)] = count > 0 ? sum / float(count) : glm::vec3(0);
+						}
+			}
+		}
+	}
+
+	//rebuild the levels above the bricks from the changed bricks, after rebuildBricks has done all of them
+	void rebuildTop() {
+		if (static_cast<int>(levels.size()) <= BRICK_LEVELS)
+			return;
+		//the level 3 cells are the bricks
+		Level& brickLevel = levels[BRICK_LEVELS - 1];
+		brickLevel.changed.clear();
+		for (int brick : changedBricks)
+			brickLevel.changed.push_back(brick);
+		for (int level = BRICK_LEVELS + 1; level <= static_cast<int>(levels.size()); level++) {
+			Level& child = levels[level - 2];
+			Level& target = levels[level - 1];
+			target.changed.clear();
+			for (int c : child.changed) {
+				glm::ivec3 cell = glm::ivec3(c % child.size.x, (c / child.size.x) % child.size.y, c / (child.size.x * child.size.y)) / 2;
+				int parent = index(target, cell);
+				if (!target.queued[parent]) {
+					target.queued[parent] = 1;
+					target.changed.push_back(parent);
+				}
+			}
+			for (int p : target.changed) {
+				glm::ivec3 cell(p % target.size.x, (p / target.size.x) % target.size.y, p / (target.size.x * target.size.y));
+				int count = 0;
+				glm::vec3 sum = sumChildren(level, cell, count);
+				target.values[p] = count > 0 ? sum / float(count) : glm::vec3(0);
+				target.queued[p] = 0;
+			}
+		}
+	}
+
+	int levelCount() const { return static_cast<int>(levels.size()); }
+
+	//the (wander, food, root) average of a level around a pheromone position, clamped to the grid
+	glm::vec3 at(int level, glm::vec3 pheromonePos) const {
+		const Level& source = levels[level - 1];
+		glm::ivec3 cell = glm::clamp(glm::ivec3(glm::floor(pheromonePos / float(1 << level))), glm::ivec3(0), source.size - 1);
+		return source.values[index(source, cell)];
+	}
+
+	//the central difference of dot(channelWeights, value) between the cells of a level either side of a pheromone position
+	glm::vec3 gradient(int level, glm::vec3 pheromonePos, glm::vec3 channelWeights) const {
+		const float width = float(1 << level);
+		glm::vec3 g(0);
+		for (int axis = 0; axis < 3; axis++) {
+			glm::vec3 offset(0);
+			offset[axis] = width;
+			g[axis] = glm::dot(channelWeights, at(level, pheromonePos + offset) - at(level, pheromonePos - offset));
+		}
+		return g;
+	}
+
+private:
+	struct Level {
+		glm::ivec3 size = glm::ivec3(0);
+		std::vector<glm::vec3> values;
+		std::vector<unsigned char> queued; //cells in changed, levels above the bricks only
+		std::vector<int> changed; //cells rebuilt in the last rebuildTop
+	};
+
+	static int index(const Level& level, glm::ivec3 cell) { return (cell.z * level.size.y + cell.y) * level.size.x + cell.x; }
+
+	//grid voxels covered by a cell of level, fewer than 8^level for the cells at the far edges of the grid
+	int voxelCount(int level, glm::ivec3 cell) const {
+		glm::ivec3 extent = glm::min(glm::ivec3(1 << level), dimensions - cell * (1 << level));
+		return extent.x * extent.y * extent.z;
+	}
+
+	//sum of the children of a cell of level (from level - 1) that are inside the grid, each times the voxels it covers
+	//count is how many voxels that is
+	glm::vec3 sumChildren(int level, glm::ivec3 cell, int& count) const {
+		const Level& child = levels[level - 2];
+		glm::vec3 sum(0);
+		count = 0;
+		for (int c = 0; c < 8; c++) {
+			glm::ivec3 childCell = cell * 2 + glm::ivec3(c & 1, (c >> 1) & 1, c >> 2);
+			if (glm::any(glm::greaterThanEqual(childCell, child.size)))
+				continue;
+			int voxels = voxelCount(level - 1, childCell);
+			sum += child.values[index(child, childCell)] * float(voxels);
+			count += voxels;
+		}
+		return sum;
+	}
+
+	glm::ivec3 dimensions = glm::ivec3(0);
+	glm::ivec3 bricks = glm::ivec3(0);
+	std::vector<unsigned char> brickChanged;
+	std::vector<int> changedBricks;
+	std::vector<Level> levels; //levels[l - 1] is level l
+};
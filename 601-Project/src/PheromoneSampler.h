@@ -0,0 +1,130 @@
+/*
+* Trilinear sampling of the pheromone grid, a batch of positions at a time
+* A voxel's value is taken to be at its centre, so a position is blended from the 8 voxels whose centres surround it, clamped at the
+* edges of the grid. The brick layout makes a voxel's index a sum of one term per axis, so the index of every corner is three adds
+* With AVX2 eight positions are done at once and each channel of each corner is one gather, the rest of a batch (or everything,
+* without AVX2) goes through the same math one position at a time
+*/
+#pragma once
+#include <glm/glm.hpp>
+#include <cmath>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+#include "Pheromones.h"
+#include "VoxelGrid.h"
+
+static_assert(sizeof(PheromoneVoxel) == PheromoneVoxel::NUMBER_OF_PHEROMONES * sizeof(float), "the sampler reads voxels as packed floats");
+
+//the per axis parts of a voxel index in the brick layout, index = x term + y term + z term
+struct BrickIndexTerms {
+	int strideY; //index distance between bricks next to each other along y
+	int strideZ; //and along z
+
+	template <typename Voxel>
+	explicit BrickIndexTerms(VoxelGrid<Voxel>& grid) {
+		const int B = VoxelGrid<Voxel>::BRICK_SIZE;
+		glm::ivec3 dimensions = glm::ivec3(grid.getDimensions());
+		int bricksX = (dimensions.x + B - 1) / B;
+		int bricksY = (dimensions.y + B - 1) / B;
+		strideY = bricksX * VoxelGrid<Voxel>::BRICK_VOLUME;
+		strideZ = bricksY * strideY;
+	}
+
+	int x(int x) const { return (x >> 3) * 512 + (x & 7); }
+	int y(int y) const { return (y >> 3) * strideY + (y & 7) * 8; }
+	int z(int z) const { return (z >> 3) * strideZ + (z & 7) * 64; }
+};
+static_assert(VoxelGrid<PheromoneVoxel>::BRICK_SIZE == 8, "BrickIndexTerms assumes 8^3 bricks");
+
+//(wander, food, root) at one position inside the grid
+inline glm::vec3 samplePheromones(const PheromoneVoxel* voxels, const BrickIndexTerms& terms, glm::ivec3 last, glm::vec3 position) {
+	glm::vec3 q = position - 0.5f;
+	glm::vec3 floored = glm::floor(q);
+	glm::vec3 t = q - floored;
+	glm::ivec3 low = glm::clamp(glm::ivec3(floored), glm::ivec3(0), last);
+	glm::ivec3 high = glm::clamp(glm::ivec3(floored) + 1, glm::ivec3(0), last);
+	int xs[2] = { terms.x(low.x), terms.x(high.x) };
+	int ys[2] = { terms.y(low.y), terms.y(high.y) };
+	int zs[2] = { terms.z(low.z), terms.z(high.z) };
+
+	glm::vec3 value(0);
+	for (int c = 0; c < 8; c++) {
+		int cx = c & 1, cy = (c >> 1) & 1, cz = c >> 2;
+		float weight = (cx ? t.x : 1 - t.x) * (cy ? t.y : 1 - t.y) * (cz ? t.z : 1 - t.z);
+		const PheromoneVoxel& voxel = voxels[xs[cx] + ys[cy] + zs[cz]];
+		value += weight * glm::vec3(voxel.pheromones[0], voxel.pheromones[1], voxel.pheromones[2]);
+	}
+	return value;
+}
+
+#if defined(__AVX2__)
+//the corner terms of one axis for 8 positions: clamped low and high voxel and the blend weight of the high one
+inline void sampleAxis(__m256 position, int last, __m256i& low, __m256i& high, __m256& t) {
+	__m256 q = _mm256_sub_ps(position, _mm256_set1_ps(0.5f));
+	__m256 floored = _mm256_floor_ps(q);
+	t = _mm256_sub_ps(q, floored);
+	__m256i voxel = _mm256_cvttps_epi32(floored);
+	__m256i zero = _mm256_setzero_si256();
+	__m256i lastVoxel = _mm256_set1_epi32(last);
+	low = _mm256_min_epi32(_mm256_max_epi32(voxel, zero), lastVoxel);
+	high = _mm256_min_epi32(_mm256_max_epi32(_mm256_add_epi32(voxel, _mm256_set1_epi32(1)), zero), lastVoxel);
+}
+
+//brick term of 8 voxel coordinates along an axis: (v >> 3) * stride + (v & 7) * step
+inline __m256i axisTerm(__m256i v, int stride, int step) {
+	__m256i brick = _mm256_mullo_epi32(_mm256_srli_epi32(v, 3), _mm256_set1_epi32(stride));
+	__m256i local = _mm256_mullo_epi32(_mm256_and_si256(v, _mm256_set1_epi32(7)), _mm256_set1_epi32(step));
+	return _mm256_add_epi32(brick, local);
+}
+#endif
+
+//write the (wander, food, root) values at count positions to values. Reads the voxels directly, nothing is marked occupied
+inline void samplePheromones(VoxelGrid<PheromoneVoxel>& grid, const glm::vec3* positions, int count, glm::vec3* values) {
+	const PheromoneVoxel* voxels = grid.voxels();
+	BrickIndexTerms terms(grid);
+	glm::ivec3 last = glm::ivec3(grid.getDimensions()) - 1;
+	int i = 0;
+
+#if defined(__AVX2__)
+	const float* channels = reinterpret_cast<const float*>(voxels);
+	for (; i + 8 <= count; i += 8) {
+		alignas(32) float coordinates[3][8];
+		for (int lane = 0; lane < 8; lane++)
+			for (int axis = 0; axis < 3; axis++)
+				coordinates[axis][lane] = positions[i + lane][axis];
+
+		__m256i low[3], high[3];
+		__m256 t[3];
+		for (int axis = 0; axis < 3; axis++)
+			sampleAxis(_mm256_load_ps(coordinates[axis]), last[axis], low[axis], high[axis], t[axis]);
+		__m256i xs[2] = { axisTerm(low[0], 512, 1), axisTerm(high[0], 512, 1) };
+		__m256i ys[2] = { axisTerm(low[1], terms.strideY, 8), axisTerm(high[1], terms.strideY, 8) };
+		__m256i zs[2] = { axisTerm(low[2], terms.strideZ, 64), axisTerm(high[2], terms.strideZ, 64) };
+		__m256 one = _mm256_set1_ps(1);
+		__m256 wx[2] = { _mm256_sub_ps(one, t[0]), t[0] };
+		__m256 wy[2] = { _mm256_sub_ps(one, t[1]), t[1] };
+		__m256 wz[2] = { _mm256_sub_ps(one, t[2]), t[2] };
+
+		__m256 sums[3] = { _mm256_setzero_ps(), _mm256_setzero_ps(), _mm256_setzero_ps() };
+		for (int c = 0; c < 8; c++) {
+			int cx = c & 1, cy = (c >> 1) & 1, cz = c >> 2;
+			__m256i index = _mm256_add_epi32(_mm256_add_epi32(xs[cx], ys[cy]), zs[cz]);
+			//3 floats per voxel
+			__m256i offset = _mm256_add_epi32(index, _mm256_slli_epi32(index, 1));
+			__m256 weight = _mm256_mul_ps(_mm256_mul_ps(wx[cx], wy[cy]), wz[cz]);
+			for (int channel = 0; channel < 3; channel++)
+				sums[channel] = _mm256_add_ps(sums[channel], _mm256_mul_ps(weight, _mm256_i32gather_ps(channels + channel, offset, 4)));
+		}
+
+		alignas(32) float results[3][8];
+		for (int channel = 0; channel < 3; channel++)
+			_mm256_store_ps(results[channel], sums[channel]);
+		for (int lane = 0; lane < 8; lane++)
+			values[i + lane] = glm::vec3(results[0][lane], results[1][lane], results[2][lane]);
+	}
+#endif
+
+	for (; i < count; i++)
+		values[i] = samplePheromones(voxels, terms, last, positions[i]);
+}
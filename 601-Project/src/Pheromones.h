@@ -1,10 +1,19 @@
 #pragma once
-#include <map>
 #include "VoxelGrid.h"
 #include <vector>
 #include "settings.h"
 #include "soil.h"
+#include "MultiResolution.h"
+#include "StepArena.h"
+#include "FieldSchedule.h"
+#include "FieldTiles.h"
+#include "PheromonePyramid.h"
 #include <array>
+#include <atomic>
+#include <memory>
+#include <algorithm>
+#include <limits>
+#include <mutex>
 
 #include "clippingPlanes.h"
 
@@ -36,6 +45,14 @@ struct PheromoneVoxel {
 		return *this;
 	}
 
+	bool isEmpty() const {
+		for (int i = 0; i < NUMBER_OF_PHEROMONES; i++) {
+			if (pheromones[i] != 0)
+				return false;
+		}
+		return true;
+	}
+
 	PheromoneVoxel operator*(const float& rhs) const {
 		PheromoneVoxel result = *this; // Create a copy of the current instance
 		for (int i = 0; i < NUMBER_OF_PHEROMONES; i++) {
@@ -52,86 +69,404 @@ const PheromoneVoxel::PheromoneProperties PheromoneVoxel::properties[NUMBER_OF_P
 		{0, 0}         // Root
 };
 
+/*
+* Running statistics of one brick of the pheromone grid, kept up to date by the kernels as they write
+* The sweeps (diffusion, evaporation) rebuild them exactly, single voxel writes in between (reactions, deposits)
+* update them incrementally so min and max are then conservative bounds. min only covers the occupied voxels of a brick
+*/
+struct PheromoneBrickSummary {
+	float min[PheromoneVoxel::NUMBER_OF_PHEROMONES];
+	float max[PheromoneVoxel::NUMBER_OF_PHEROMONES];
+	float sum[PheromoneVoxel::NUMBER_OF_PHEROMONES];
+
+	PheromoneBrickSummary() { reset(); }
+
+	void reset() {
+		for (int i = 0; i < PheromoneVoxel::NUMBER_OF_PHEROMONES; i++) {
+			min[i] = std::numeric_limits<float>::max();
+			max[i] = 0;
+			sum[i] = 0;
+		}
+	}
+
+	//account for a voxel that was written during a sweep, or for that many voxels holding the same values
+	void add(const PheromoneVoxel& voxel, int voxels = 1) {
+		for (int i = 0; i < PheromoneVoxel::NUMBER_OF_PHEROMONES; i++) {
+			min[i] = std::min(min[i], voxel.pheromones[i]);
+			max[i] = std::max(max[i], voxel.pheromones[i]);
+			sum[i] += voxel.pheromones[i] * voxels;
+		}
+	}
+
+	//account for a single channel of a voxel (or of that many voxels) changing outside of a sweep
+	void update(int channel, float oldValue, float newValue, int voxels = 1) {
+		min[channel] = std::min(min[channel], newValue);
+		max[channel] = std::max(max[channel], newValue);
+		sum[channel] += (newValue - oldValue) * voxels;
+	}
+
+	void merge(const PheromoneBrickSummary& other) {
+		for (int i = 0; i < PheromoneVoxel::NUMBER_OF_PHEROMONES; i++) {
+			min[i] = std::min(min[i], other.min[i]);
+			max[i] = std::max(max[i], other.max[i]);
+			sum[i] += other.sum[i];
+		}
+	}
+
+	bool isEmpty() const {
+		for (int i = 0; i < PheromoneVoxel::NUMBER_OF_PHEROMONES; i++)
+			if (max[i] > 0)
+				return false;
+		return true;
+	}
+};
+
+//one summary per brick of the pheromone grid
+std::vector<PheromoneBrickSummary> pheromoneSummaries;
+
+//make sure there is a summary for every brick, the grid starts out empty so fresh summaries are correct
+void prepareSummaries(VoxelGrid<PheromoneVoxel>& pheromones) {
+	if (pheromoneSummaries.size() != static_cast<size_t>(pheromones.getBrickCount()))
+		pheromoneSummaries.assign(pheromones.getBrickCount(), PheromoneBrickSummary());
+}
+
+//global reduction of the brick summaries, O(bricks)
+PheromoneBrickSummary summarizePheromones(VoxelGrid<PheromoneVoxel>& pheromones) {
+	prepareSummaries(pheromones);
+	PheromoneBrickSummary total;
+	for (const PheromoneBrickSummary& summary : pheromoneSummaries)
+		total.merge(summary);
+	return total;
+}
+
+//the parts of the field at soil resolution
+FieldTiles<PheromoneVoxel> pheromoneTiles;
+//averages of the field over growing regions, told about every brick that is written
+PheromonePyramid<PheromoneVoxel> pheromonePyramid;
+const int PHEROMONE_BLOCK_VOLUME = PHEROMONE_RESOLUTION * PHEROMONE_RESOLUTION * PHEROMONE_RESOLUTION; //pheromone voxels in a soil voxel
+
+//a coarse voxel counts towards the summary of the brick that holds the centre of its block, as that many voxels of its value
+int coarseSummaryBrick(VoxelGrid<PheromoneVoxel>& pheromones, glm::ivec3 cell) {
+	return pheromones.brickOf(pheromones.posToIndex(soilCellCentre(glm::vec3(cell))));
+}
+
+//held while the simulation writes the voxels, the summaries or the coarse tiles, and by the render thread while it reads them
+std::mutex mutex;
+
+//add pheromone to a voxel and keep the summary of its brick current, with the mutex held and the summaries and schedule prepared
+void addPheromone(VoxelGrid<PheromoneVoxel>& pheromones, glm::vec3 position, PheromoneVoxel::Pheromones type, float amount) {
+	int index = pheromones.posToIndex(position);
+	pheromoneSchedule.markActive(pheromones.brickOf(index));
+	pheromonePyramid.markChanged(pheromones.brickOf(index));
+	pheromoneTiles.visit(position);
+	//a coarse tile takes the deposit into the soil voxel it lands in, shared out over the voxel's block
+	if (pheromoneTiles.isCoarseBrick(pheromones.brickOf(index))) {
+		glm::ivec3 cell = glm::ivec3(soilCellOf(position));
+		float& coarsePheromone = pheromoneTiles.coarseAt(cell).pheromones[type];
+		float share = amount / PHEROMONE_BLOCK_VOLUME;
+		pheromoneSummaries[coarseSummaryBrick(pheromones, cell)].update(type, coarsePheromone, coarsePheromone + share, PHEROMONE_BLOCK_VOLUME);
+		coarsePheromone += share;
+		return;
+	}
+	float& pheromone = pheromones.at(index).pheromones[type];
+	pheromoneSummaries[pheromones.brickOf(index)].update(type, pheromone, pheromone + amount);
+	pheromone += amount;
+}
+
+//add pheromone to a voxel and keep the summary of its brick current
+void depositPheromone(VoxelGrid<PheromoneVoxel>& pheromones, glm::vec3 position, PheromoneVoxel::Pheromones type, float amount) {
+	std::lock_guard<std::mutex> lock(mutex);
+	prepareSummaries(pheromones);
+	pheromoneSchedule.prepare(pheromones);
+	addPheromone(pheromones, position, type, amount);
+}
+
+//make a phase's deposits in one pass under a single hold of the mutex
+//deposits(deposit) calls deposit(position, type, amount) for each of them, in the order they are to be made
+template <typename F>
+void depositPheromones(VoxelGrid<PheromoneVoxel>& pheromones, const F& deposits) {
+	std::lock_guard<std::mutex> lock(mutex);
+	prepareSummaries(pheromones);
+	pheromoneSchedule.prepare(pheromones);
+	deposits([&](glm::vec3 position, PheromoneVoxel::Pheromones type, float amount) { addPheromone(pheromones, position, type, amount); });
+}
+
 struct pheremoneRenderData {
 	glm::mat4 transform = glm::mat4(1);
 	glm::vec3 color = glm::vec3(0);
 };
 
-std::mutex mutex;
+//food pheromone that has built up turns into established root pheromone
+inline void reactPheromones(PheromoneVoxel& voxel) {
+	if (voxel.pheromones[PheromoneVoxel::Food] > 5) {
+		voxel.pheromones[PheromoneVoxel::Root] += 1;
+		voxel.pheromones[PheromoneVoxel::Food] -= 5;
+	}
+}
 
-void diffusePheromones(VoxelGrid<PheromoneVoxel>& pheromones, VoxelGrid<SoilVoxel>& soil) {
-	std::lock_guard<std::mutex> lock(mutex);
-	//evaporate pheremones outwards
-	std::map<int, PheromoneVoxel> newPheremoneMap;
-	for (int e : pheromones.getOccupiedMap()) {
-		glm::vec3 originVoxelPos = pheromones.indexToPos(e);
-		//for each voxel with a pheremone cosntruct a list of what neighbour voxels can be diffused to
-		std::vector<glm::vec3> neighbours;
-		for (int x = -1; x <= 1; x++) {
-			for (int y = -1; y <= 1; y++) {
-				for (int z = -1; z <= 1; z++) {
-					glm::vec3 neighbourVoxelPos = originVoxelPos + glm::vec3(x, y, z);
-					//check the voxel is in bounds
-					if (neighbourVoxelPos.x < 0 || neighbourVoxelPos.x > SOIL_X_LENGTH * 3 - 1
-						|| neighbourVoxelPos.y < 0 || neighbourVoxelPos.y > SOIL_Y_LENGTH * 3 - 1
-						|| neighbourVoxelPos.z < 0 || neighbourVoxelPos.z > SOIL_Z_LENGTH * 3 - 1)
-						continue;
-					//check if the neighbour position is in a soil voxel
-					if (soil.at(floor(neighbourVoxelPos / 3.f)).isSoil)
-						continue;
+inline void evaporatePheromones(PheromoneVoxel& voxel) {
+	for (int i = 0; i < PheromoneVoxel::NUMBER_OF_PHEROMONES; i++) {
+		float& pheromone = voxel.pheromones[i];
+		pheromone = pheromone > 0.02 ? pheromone - log(PheromoneVoxel::properties[i].evaporation * pheromone + 1) : 0;
+	}
+}
 
-					//add it to the neighbour list
-					neighbours.push_back(neighbourVoxelPos);
+/*
+* A field step (reactions, diffusion, evaporation) is done in two halves so it can overlap with the agents, who only read the grid
+* advancePheromoneBricks and advanceCoarsePheromones react and diffuse the grid's values into diffusionScratch without writing
+* the grid, the reactions are applied to each voxel's values on the way through. commitPheromones evaporates the new values and
+* writes them back, it must not run while anything reads the grid. The scratch lives for the whole run and is emptied at the end
+* of every commit, so the field step does not allocate once it is sized
+* The due fine bricks are split by the parity of their brick coordinates. Bricks of the same parity are at least one brick apart,
+* and a voxel only spreads into its neighbours, so the bricks of one parity can diffuse on different threads without writing
+* the same voxel. The step runs the eight parities one after the other, each as one task node over its bricks
+* diffusionTargetBricks marks the bricks the diffusion wrote into, the commit goes through their voxels in index order
+* Only the bricks pheromoneSchedule says are due advance, each by as many steps as it has waited. A brick that waited k steps
+* reacts and evaporates k times and diffuses k times the rate in one go. What diffuses into a waiting brick is added to it as it
+* is, so the pheromone leaving one brick is exactly what arrives in the next whatever their rates
+* The tiles of pheromoneTiles at soil resolution advance every step on their soil voxels instead of their bricks. What diffuses
+* between a coarse and a fine tile is moved between a soil voxel and its block of pheromone voxels, again without loss
+* Only the simulation thread changes the grid, its occupied set and the summaries, and it holds mutex when it does. The render
+* thread only reads them, under mutex, so the advance can read them without it. The commit drops the voxels that
+* evaporated to nothing from the occupied set
+*/
+std::vector<PheromoneVoxel> diffusionScratch;
+std::unique_ptr<std::atomic<unsigned char>[]> diffusionTargetBricks;
+std::array<std::vector<int>, 8> dueFieldBricks; //the due fine bricks of each brick parity
+
+int brickParity(VoxelGrid<PheromoneVoxel>& pheromones, int brick) {
+	glm::ivec3 coordinates = glm::ivec3(pheromones.brickOrigin(brick)) / VoxelGrid<PheromoneVoxel>::BRICK_SIZE;
+	return (coordinates.x & 1) | ((coordinates.y & 1) << 1) | ((coordinates.z & 1) << 2);
+}
+
+//decide which tiles are coarse and which bricks advance this step, once the agents have visited the tiles and marked their bricks
+void planPheromones(VoxelGrid<PheromoneVoxel>& pheromones, SoilGrid& soil) {
+	//changing a tile's resolution writes its voxels, summaries and coarse values
+	std::unique_lock<std::mutex> lock(mutex);
+	prepareSummaries(pheromones);
+	pheromoneSchedule.prepare(pheromones);
+	pheromoneTiles.prepare(soil, pheromones);
+	pheromoneTiles.update([&](glm::ivec3 cellMin, glm::ivec3 cellMax) {
+		//the restriction runs on the worker pool, which the step's graph holds while the commit takes the lock, so it runs
+		//without the lock. The tile is not coarse yet, so the render thread does not read the coarse voxels it writes
+		lock.unlock();
+		restrictPheromones(pheromones, pheromoneTiles.coarseGrid(), RestrictionOp::AVERAGE, cellMin, cellMax);
+		lock.lock();
+	}, [&](glm::ivec3 cellMin, glm::ivec3 cellMax, glm::ivec3 brickMin, glm::ivec3 brickMax) {
+		prolongPheromones(pheromoneTiles.coarseGrid(), pheromones, cellMin, cellMax);
+		//the bricks hold what they held before the tile went coarse, scaled to its values now
+		for (int z = brickMin.z; z < brickMax.z; z++)
+			for (int y = brickMin.y; y < brickMax.y; y++)
+				for (int x = brickMin.x; x < brickMax.x; x++) {
+					int brick = pheromoneTiles.brickIndex(glm::ivec3(x, y, z));
+					pheromoneSummaries[brick].reset();
+					pheromones.getOccupiedMap().forEachIn(brick * VoxelGrid<PheromoneVoxel>::BRICK_VOLUME, (brick + 1) * VoxelGrid<PheromoneVoxel>::BRICK_VOLUME, [&](int e) {
+						pheromoneSummaries[brick].add(pheromones.peek(e));
+					});
+					pheromoneSchedule.restart(brick);
+					pheromonePyramid.markChanged(brick);
 				}
-			}
+	});
+	pheromoneSchedule.plan([](int brick) {
+		const PheromoneBrickSummary& summary = pheromoneSummaries[brick];
+		for (int i = 0; i < PheromoneVoxel::NUMBER_OF_PHEROMONES; i++) {
+			if (PheromoneVoxel::properties[i].diffusion > 0 && summary.max[i] - summary.min[i] > FIELD_STEEP_SPREAD)
+				return true;
 		}
+		return false;
+	});
 
-		
-		//for each neighbour in the list add some pheremone to it
-		PheromoneVoxel original = pheromones.at(originVoxelPos);
-		for (glm::vec3 neighbourPos : neighbours) {
-			PheromoneVoxel neighbour;
-			for (int i = 0; i < neighbour.NUMBER_OF_PHEROMONES; i++) {
-				neighbour.pheromones[i] += (original.pheromones[i] * PheromoneVoxel::properties[i].diffusion) / neighbours.size();
+	size_t volume = static_cast<size_t>(pheromones.getBrickCount()) * VoxelGrid<PheromoneVoxel>::BRICK_VOLUME;
+	if (diffusionScratch.size() != volume) {
+		diffusionScratch.assign(volume, PheromoneVoxel());
+		diffusionTargetBricks.reset(new std::atomic<unsigned char>[pheromones.getBrickCount()]);
+		for (int brick = 0; brick < pheromones.getBrickCount(); brick++)
+			diffusionTargetBricks[brick].store(0, std::memory_order_relaxed);
+		for (std::vector<int>& bricks : dueFieldBricks)
+			bricks.reserve(pheromones.getBrickCount());
+	}
+	for (std::vector<int>& bricks : dueFieldBricks)
+		bricks.clear();
+	for (int brick : pheromoneSchedule.due()) {
+		if (!pheromoneTiles.isCoarseBrick(brick))
+			dueFieldBricks[brickParity(pheromones, brick)].push_back(brick);
+	}
+}
+
+//react and diffuse the due fine bricks [begin, end) of one parity
+void advancePheromoneBricks(VoxelGrid<PheromoneVoxel>& pheromones, SoilGrid& soil, int parity, int begin, int end) {
+	for (int b = begin; b < end; b++) {
+		const int brick = dueFieldBricks[parity][b];
+		const int steps = pheromoneSchedule.stepsOf(brick);
+		std::array<double, PheromoneVoxel::NUMBER_OF_PHEROMONES> diffusion;
+		for (int i = 0; i < PheromoneVoxel::NUMBER_OF_PHEROMONES; i++)
+			diffusion[i] = std::min(1.0, PheromoneVoxel::properties[i].diffusion * steps);
+
+		//evaporate pheremones outwards
+		pheromones.getOccupiedMap().forEachIn(brick * VoxelGrid<PheromoneVoxel>::BRICK_VOLUME, (brick + 1) * VoxelGrid<PheromoneVoxel>::BRICK_VOLUME, [&](int e) {
+			glm::vec3 originVoxelPos = pheromones.indexToPos(e);
+			//for each voxel with a pheremone cosntruct a list of what neighbour voxels can be diffused to
+			std::array<int, 27> neighbours;
+			int neighbourCount = 0;
+			for (int x = -1; x <= 1; x++) {
+				for (int y = -1; y <= 1; y++) {
+					for (int z = -1; z <= 1; z++) {
+						glm::vec3 neighbourVoxelPos = originVoxelPos + glm::vec3(x, y, z);
+						//check the voxel is in bounds
+						if (!inPheromoneGrid(neighbourVoxelPos))
+							continue;
+						//check if the neighbour position is in a soil voxel
+						if (soil.isSoil(soilCellOf(neighbourVoxelPos)))
+							continue;
+
+						//add it to the neighbour list
+						neighbours[neighbourCount++] = pheromones.posToIndex(neighbourVoxelPos);
+					}
+				}
 			}
-			newPheremoneMap[pheromones.posToIndex(neighbourPos)] += neighbour;
-		}
 
-		for(int i = 0; i < PheromoneVoxel::NUMBER_OF_PHEROMONES; i++)
-			newPheremoneMap[pheromones.posToIndex(originVoxelPos)].pheromones[i] += pheromones.at(originVoxelPos).pheromones[i] * (1 - PheromoneVoxel::properties[i].diffusion);
-		
+			
+			//for each neighbour in the list add some pheremone to it
+			PheromoneVoxel original = pheromones.peek(e);
+			for (int step = 0; step < steps; step++)
+				reactPheromones(original);
+			for (int n = 0; n < neighbourCount; n++) {
+				PheromoneVoxel& neighbour = diffusionScratch[neighbours[n]];
+				for (int i = 0; i < PheromoneVoxel::NUMBER_OF_PHEROMONES; i++) {
+					neighbour.pheromones[i] += (original.pheromones[i] * diffusion[i]) / neighbourCount;
+				}
+				diffusionTargetBricks[pheromones.brickOf(neighbours[n])].store(1, std::memory_order_relaxed);
+			}
 
+			for(int i = 0; i < PheromoneVoxel::NUMBER_OF_PHEROMONES; i++)
+				diffusionScratch[e].pheromones[i] += original.pheromones[i] * (1 - diffusion[i]);
+			diffusionTargetBricks[brick].store(1, std::memory_order_relaxed);
+		});
 	}//end neighbour diffusion loop
-
-	//update the actual map with the new pheromones
-	for (auto e : newPheremoneMap)
-		pheromones.at(e.first) = e.second;
 }
 
-void evaporatePheromones(VoxelGrid<PheromoneVoxel>& pheromones) {
-	std::lock_guard<std::mutex> lock(mutex);
-	//evaporate pheremones
-	for (auto e : pheromones.getOccupiedMap()) {
-		for (int i = 0; i < PheromoneVoxel::NUMBER_OF_PHEROMONES; i++) {
-			float& pheromone = pheromones.at(e).pheromones[i];
-			pheromone = pheromone > 0.02 ? pheromone - log(PheromoneVoxel::properties[i].evaporation * pheromone + 1) : 0;
+//react and diffuse the tiles at soil resolution, after every parity of fine bricks
+void advanceCoarsePheromones(VoxelGrid<PheromoneVoxel>& pheromones, SoilGrid& soil) {
+	//a soil voxel is PHEROMONE_RESOLUTION times as wide, so the same spreading moves PHEROMONE_RESOLUTION^2 times less of it a step
+	std::array<double, PheromoneVoxel::NUMBER_OF_PHEROMONES> coarseDiffusion;
+	for (int i = 0; i < PheromoneVoxel::NUMBER_OF_PHEROMONES; i++)
+		coarseDiffusion[i] = PheromoneVoxel::properties[i].diffusion / (PHEROMONE_RESOLUTION * PHEROMONE_RESOLUTION);
+	glm::ivec3 cells = glm::ivec3(soil.getDimensions());
+	for (int tile : pheromoneTiles.coarseTiles()) {
+		glm::ivec3 cellMin, cellMax, brickMin, brickMax;
+		pheromoneTiles.ranges(tile, cellMin, cellMax, brickMin, brickMax);
+		for (int z = cellMin.z; z < cellMax.z; z++)
+			for (int y = cellMin.y; y < cellMax.y; y++)
+				for (int x = cellMin.x; x < cellMax.x; x++) {
+					glm::ivec3 cell(x, y, z);
+					PheromoneVoxel original = pheromoneTiles.coarseAt(cell);
+					bool empty = true;
+					for (int i = 0; i < PheromoneVoxel::NUMBER_OF_PHEROMONES; i++)
+						empty = empty && original.pheromones[i] == 0;
+					if (empty)
+						continue;
+					reactPheromones(original);
 
-		}
+					std::array<glm::ivec3, 27> neighbours;
+					int neighbourCount = 0;
+					for (int dz = -1; dz <= 1; dz++)
+						for (int dy = -1; dy <= 1; dy++)
+							for (int dx = -1; dx <= 1; dx++) {
+								glm::ivec3 neighbour = cell + glm::ivec3(dx, dy, dz);
+								if (glm::any(glm::lessThan(neighbour, glm::ivec3(0))) || glm::any(glm::greaterThanEqual(neighbour, cells)) || soil.isSoil(glm::vec3(neighbour)))
+									continue;
+								neighbours[neighbourCount++] = neighbour;
+							}
+
+					PheromoneVoxel share;
+					for (int i = 0; i < PheromoneVoxel::NUMBER_OF_PHEROMONES; i++)
+						share.pheromones[i] = original.pheromones[i] * coarseDiffusion[i] / neighbourCount;
+					for (int n = 0; n < neighbourCount; n++) {
+						if (pheromoneTiles.isCoarseCell(neighbours[n])) {
+							pheromoneTiles.coarseNext(neighbours[n]) += share;
+							continue;
+						}
+						//a soil voxel of a fine tile gets its share in every pheromone voxel of its block
+						for (int b = 0; b < PHEROMONE_BLOCK_VOLUME; b++) {
+							glm::ivec3 offset(b % PHEROMONE_RESOLUTION, b / PHEROMONE_RESOLUTION % PHEROMONE_RESOLUTION, b / (PHEROMONE_RESOLUTION * PHEROMONE_RESOLUTION));
+							int target = pheromones.posToIndex(glm::vec3(neighbours[n] * PHEROMONE_RESOLUTION + offset));
+							diffusionScratch[target] += share;
+							diffusionTargetBricks[pheromones.brickOf(target)].store(1, std::memory_order_relaxed);
+						}
+					}
+					PheromoneVoxel& next = pheromoneTiles.coarseNext(cell);
+					for (int i = 0; i < PheromoneVoxel::NUMBER_OF_PHEROMONES; i++)
+						next.pheromones[i] += original.pheromones[i] * (1 - coarseDiffusion[i]);
+				}
 	}
 }
 
-void pheromoneReactions(VoxelGrid<PheromoneVoxel>& pheromones) {
+void commitPheromones(VoxelGrid<PheromoneVoxel>& pheromones) {
 	std::lock_guard<std::mutex> lock(mutex);
-	for (auto e : pheromones.getOccupiedMap()) {
-		if (pheromones.at(e).pheromones[PheromoneVoxel::Food] > 5) {
-			//convert food pheromone into established root pheromones
-			pheromones.at(e).pheromones[PheromoneVoxel::Root] += 1;
-			pheromones.at(e).pheromones[PheromoneVoxel::Food] -= 5;
+	//update the actual map with the new pheromones. Every occupied voxel of a brick that advanced is written so its summary is rebuilt
+	prepareSummaries(pheromones);
+	for (int brick : pheromoneSchedule.due())
+		pheromoneSummaries[brick].reset();
+	//a voxel the diffusion wrote into has a value in the scratch, or is one of the occupied voxels of a brick that advanced
+	for (int brick = 0; brick < pheromones.getBrickCount(); brick++) {
+		if (diffusionTargetBricks[brick].load(std::memory_order_relaxed) == 0)
+			continue;
+		diffusionTargetBricks[brick].store(0, std::memory_order_relaxed);
+		const bool coarse = pheromoneTiles.isCoarseBrick(brick);
+		const int steps = pheromoneSchedule.stepsOf(brick);
+		for (int e = brick * VoxelGrid<PheromoneVoxel>::BRICK_VOLUME; e < (brick + 1) * VoxelGrid<PheromoneVoxel>::BRICK_VOLUME; e++) {
+			if (diffusionScratch[e].isEmpty() && (coarse || steps == 0 || !pheromones.getOccupiedMap().contains(e)))
+				continue;
+			//what spreads into a coarse tile joins the soil voxel it lands in
+			if (coarse) {
+				pheromoneTiles.coarseNext(glm::ivec3(soilCellOf(pheromones.indexToPos(e)))) += diffusionScratch[e] * (1.f / PHEROMONE_BLOCK_VOLUME);
+				diffusionScratch[e] = PheromoneVoxel();
+				continue;
+			}
+			pheromonePyramid.markChanged(brick);
+			PheromoneVoxel& voxel = pheromones.at(e);
+			if (steps > 0) {
+				for (int step = 0; step < steps; step++)
+					evaporatePheromones(diffusionScratch[e]);
+				voxel = diffusionScratch[e];
+				pheromoneSummaries[brick].add(voxel);
+			}
+			else {
+				for (int i = 0; i < PheromoneVoxel::NUMBER_OF_PHEROMONES; i++) {
+					pheromoneSummaries[brick].update(i, voxel.pheromones[i], voxel.pheromones[i] + diffusionScratch[e].pheromones[i]);
+					voxel.pheromones[i] += diffusionScratch[e].pheromones[i];
+				}
+			}
+			diffusionScratch[e] = PheromoneVoxel();
+			if (voxel.isEmpty())
+				pheromones.markUnoccupied(e);
 		}
 	}
+
+	for (int tile : pheromoneTiles.coarseTiles()) {
+		glm::ivec3 cellMin, cellMax, brickMin, brickMax;
+		pheromoneTiles.ranges(tile, cellMin, cellMax, brickMin, brickMax);
+		for (int z = brickMin.z; z < brickMax.z; z++)
+			for (int y = brickMin.y; y < brickMax.y; y++)
+				for (int x = brickMin.x; x < brickMax.x; x++) {
+					int brick = pheromoneTiles.brickIndex(glm::ivec3(x, y, z));
+					pheromoneSummaries[brick].reset();
+					pheromonePyramid.markChanged(brick);
+				}
+		for (int z = cellMin.z; z < cellMax.z; z++)
+			for (int y = cellMin.y; y < cellMax.y; y++)
+				for (int x = cellMin.x; x < cellMax.x; x++) {
+					glm::ivec3 cell(x, y, z);
+					PheromoneVoxel& next = pheromoneTiles.coarseNext(cell);
+					evaporatePheromones(next);
+					pheromoneTiles.coarseAt(cell) = next;
+					pheromoneSummaries[coarseSummaryBrick(pheromones, cell)].add(next, PHEROMONE_BLOCK_VOLUME);
+					next = PheromoneVoxel();
+				}
+	}
 }
 
-void loadPheremoneRenderData(VoxelGrid<PheromoneVoxel>& pheromones, std::vector<pheremoneRenderData>& instancedPheremoneData, std::vector<PheromoneVoxel::Pheromones> filter = {}, clippingPlanes* clip = nullptr) {
+void loadPheremoneRenderData(VoxelGrid<PheromoneVoxel>& pheromones, std::vector<pheremoneRenderData>& instancedPheremoneData, const std::pmr::vector<PheromoneVoxel::Pheromones>& filter = {}, clippingPlanes* clip = nullptr) {
 	glm::vec3 upperBounds;
 	glm::vec3 lowerBounds;
 	if (clip == nullptr) {
@@ -164,45 +499,51 @@ void loadPheremoneRenderData(VoxelGrid<PheromoneVoxel>& pheromones, std::vector<
 	}
 
 
-	std::array<float, PheromoneVoxel::NUMBER_OF_PHEROMONES> maxs;
+	//normalise against the largest value of the bricks that can be seen, O(bricks) instead of a pass over the voxels
+	prepareSummaries(pheromones);
+	std::array<float, PheromoneVoxel::NUMBER_OF_PHEROMONES> maxs = {};
+	for (int brick = 0; brick < pheromones.getBrickCount(); brick++) {
+		glm::vec3 brickMin = pheromones.brickOrigin(brick);
+		glm::vec3 brickMax = brickMin + glm::vec3(VoxelGrid<PheromoneVoxel>::BRICK_SIZE);
+		if (brickMax.x <= lowerBounds.x || brickMin.x >= upperBounds.x ||
+			brickMax.y <= lowerBounds.y || brickMin.y >= upperBounds.y ||
+			brickMax.z <= lowerBounds.z || brickMin.z >= upperBounds.z)
+			continue;
+		for (int i = 0; i < PheromoneVoxel::NUMBER_OF_PHEROMONES; i++)
+			maxs[i] = std::max(maxs[i], pheromoneSummaries[brick].max[i]);
+	}
 
-	std::vector<int> toMarkUnoccupied;
+	//only reads, the simulation keeps the occupied set and the summaries up to date
 	for (auto e : pheromones.getOccupiedMap()) {
+		int brick = pheromones.brickOf(e);
+		if (pheromoneSummaries[brick].isEmpty())
+			continue;
+
 		glm::vec3 position = pheromones.indexToPos(e);
 		if (position.x < lowerBounds.x || position.x >= upperBounds.x ||
 			position.y < lowerBounds.y || position.y >= upperBounds.y ||
 			position.z < lowerBounds.z || position.z >= upperBounds.z)
 			continue;
 		
-		PheromoneVoxel voxel = pheromones.at(position);
-
-		int zeros = 0;
-		for (int i = 0; i < PheromoneVoxel::NUMBER_OF_PHEROMONES; i++) {
-			maxs[i] = std::max(maxs[i], voxel.pheromones[i]);
-			if (voxel.pheromones[i] == 0)
-				zeros++;
-		}
-		if (zeros == PheromoneVoxel::NUMBER_OF_PHEROMONES) {
-			toMarkUnoccupied.push_back(e);
-			continue;
-		}
+		//coarse tiles show their soil voxel's value over the pattern they keep
+		PheromoneVoxel voxel = pheromoneTiles.isCoarseBrick(brick) ? pheromoneTiles.coarseAt(glm::ivec3(soilCellOf(position))) : pheromones.voxels()[e];
 
 		pheremoneRenderData data;
 		data.color = voxel.pheromones[PheromoneVoxel::Food] * glm::vec3(0, 0, 1) * renderFlags[PheromoneVoxel::Food] +
 								voxel.pheromones[PheromoneVoxel::Wander] * glm::vec3(0, 1, 0) * renderFlags[PheromoneVoxel::Wander] +
 								voxel.pheromones[PheromoneVoxel::Root] * glm::vec3(1, 0, 0) * renderFlags[PheromoneVoxel::Root];
 		if (glm::length(data.color) > 0) {
-			data.transform = glm::translate(glm::mat4(1), (position - glm::vec3(1)) / 3.f) * glm::scale(glm::mat4(1), glm::vec3(1 / 3.f));
+			data.transform = pheromoneCellTransform(position);
 			instancedPheremoneData.push_back(data);
 		}
 	}
 
-	for (auto e : toMarkUnoccupied)
-		pheromones.markUnoccupied(e);
-
 	for (auto& e : instancedPheremoneData) {
-		e.color.b /= maxs[PheromoneVoxel::Food];
-		e.color.g /= maxs[PheromoneVoxel::Wander];
-		e.color.r /= maxs[PheromoneVoxel::Root];
+		if (maxs[PheromoneVoxel::Food] > 0)
+			e.color.b /= maxs[PheromoneVoxel::Food];
+		if (maxs[PheromoneVoxel::Wander] > 0)
+			e.color.g /= maxs[PheromoneVoxel::Wander];
+		if (maxs[PheromoneVoxel::Root] > 0)
+			e.color.r /= maxs[PheromoneVoxel::Root];
 	}
 }
@@ -0,0 +1,68 @@
+/*
+* One step of the whole simulation, shared by the viewer's simulation thread and the headless runner in tests/
+* Everything it needs is header only, so it builds without a window or an OpenGL context
+*/
+#pragma once
+#include "settings.h"
+#include "VoxelGrid.h"
+#include "Pheromones.h"
+#include "soil.h"
+#include "agent.h"
+#include "TaskGraph.h"
+#include "StepArena.h"
+#include <array>
+
+//the colony a run starts with, searching from the nest
+void spawnStartingAgents(AgentPool& agents) {
+	for (int i = 0; i < NUMBER_OF_STARTING_AGENTS; i++) {
+		Agent a = Agent();
+		a.state = a.SEARCHING;
+		a.position = AgentPool::nestPosition();
+		agents.spawn(a);
+	}
+}
+
+void stepSimulation(SoilGrid& soil, VoxelGrid<PheromoneVoxel>& pheromones, AgentPool& agents) {
+	//the field works out the next pheromones while the agents read the current ones, the agents' graph makes the commit
+	//wait for their reads and holds back their deposits and soil changes until it has run
+	//the bricks with agents in them advance the field every step, the ones far from them less often or at soil resolution
+	pheromoneSchedule.prepare(pheromones);
+	pheromoneTiles.prepare(soil, pheromones);
+	//an agent reads and bites the soil a cell around it, those bricks are the ones a mapped world keeps resident
+	for (int slot = 0; slot < agents.slotCount(); slot++) {
+		if (agents.isActive(slot)) {
+			pheromoneSchedule.markActive(pheromones.brickOf(pheromones.posToIndex(agents.position(slot))));
+			pheromoneTiles.visit(agents.position(slot));
+			soil.markActive(glm::ivec3(soilCellOf(agents.position(slot))), 1);
+		}
+	}
+	planPheromones(pheromones, soil);
+	TaskGraph& graph = stepGraph();
+	graph.clear();
+	//one node per brick parity, each over its bricks, then the coarse tiles, which also spread into fine bricks of any parity
+	auto advanceParity = [&](int parity) {
+		return [&pheromones, &soil, parity](int begin, int end, int) { advancePheromoneBricks(pheromones, soil, parity, begin, end); };
+	};
+	std::array<decltype(advanceParity(0)), 8> advanceBricks = { advanceParity(0), advanceParity(1), advanceParity(2), advanceParity(3),
+		advanceParity(4), advanceParity(5), advanceParity(6), advanceParity(7) };
+	auto advanceCoarse = [&](int, int, int) { advanceCoarsePheromones(pheromones, soil); };
+	auto commitField = [&](int, int, int) { commitPheromones(pheromones); };
+	static const char* const parityNames[8] = { "field advance 0", "field advance 1", "field advance 2", "field advance 3",
+		"field advance 4", "field advance 5", "field advance 6", "field advance 7" };
+	int previousNode = -1;
+	for (int parity = 0; parity < 8; parity++) {
+		int parityNode = graph.add(parityNames[parity], static_cast<int>(dueFieldBricks[parity].size()), advanceBricks[parity]);
+		if (previousNode >= 0)
+			graph.precede(previousNode, parityNode);
+		previousNode = parityNode;
+	}
+	int coarseNode = graph.add("field coarse advance", 1, advanceCoarse);
+	int commitNode = graph.add("field commit", 1, commitField);
+	graph.precede(previousNode, coarseNode);
+	graph.precede(coarseNode, commitNode);
+	stepAgents(agents, pheromones, soil, graph, commitNode);
+	//let a mapped world page out the soil away from the agents
+	soil.adviseResidency();
+	//nothing built from the step arena outlives the step
+	stepArena().reset();
+}
@@ -0,0 +1,91 @@
+/*
+* Searching agents biting soil, applied after the agents have moved so that the movement itself can run in parallel
+* Every thread records the bites of its agents, then the bites are applied one soil voxel at a time in agent id order. Two agents
+* hitting the same voxel in a step always share it out the same way, whatever threads they ran on, and nothing is written to
+* the soil while the agents move. Voxels that run out are reported as depletion events to whatever keeps state built from the soil
+*/
+#pragma once
+#include <glm/glm.hpp>
+#include <algorithm>
+#include <memory_resource>
+#include <vector>
+#include "StepArena.h"
+#include "WorkerPool.h"
+#include "soil.h"
+
+struct SoilBite {
+	glm::ivec3 cell; //the soil voxel
+	int agentId;
+	int slot;
+	glm::vec3 position; //where the agent was when it bit
+};
+
+class SoilConsumption {
+public:
+	//set up the per thread records and forget the last step's events, call before the phase that records bites
+	//only allocates the first time, every voxel of the soil can be reported without growing the event list
+	void begin(SoilGrid& soil) {
+		if (threads.empty()) {
+			threads.reserve(workerPool().size());
+			for (int thread = 0; thread < workerPool().size(); thread++)
+				threads.emplace_back(stepArena().resource(thread));
+			glm::ivec3 dimensions = glm::ivec3(soil.getDimensions());
+			depletions.reserve(static_cast<size_t>(dimensions.x) * dimensions.y * dimensions.z);
+		}
+		depletions.clear();
+	}
+
+	//thread is the worker pool thread the caller runs on
+	void record(const SoilBite& bite, int thread) { threads[thread].push_back(bite); }
+
+	/*
+	* Apply the recorded bites, sorted by soil voxel then agent id. Each bite of a voxel that is still soil takes one unit of nutrient
+	* bitten(bite, nutrient) gets the nutrient the voxel held before the bite, or a negative value when an agent earlier in the order
+	* already used it up. thread is the worker pool thread the caller runs on, the merged list comes from its arena. Must run before
+	* the step arena is reset
+	*/
+	template <typename F>
+	void resolve(SoilGrid& soil, int thread, const F& bitten) {
+		size_t count = 0;
+		for (const std::pmr::vector<SoilBite>& bites : threads)
+			count += bites.size();
+		if (count == 0)
+			return;
+		std::pmr::vector<SoilBite> bites(stepArena().resource(thread));
+		bites.reserve(count);
+		for (std::pmr::vector<SoilBite>& recorded : threads) {
+			bites.insert(bites.end(), recorded.begin(), recorded.end());
+			//drop the storage rather than clearing it, it belongs to this step's arena
+			recorded = std::pmr::vector<SoilBite>(recorded.get_allocator());
+		}
+		glm::ivec3 dimensions = glm::ivec3(soil.getDimensions());
+		auto cellIndex = [&](glm::ivec3 cell) { return cell.x + dimensions.x * (cell.y + dimensions.y * cell.z); };
+		std::sort(bites.begin(), bites.end(), [&](const SoilBite& a, const SoilBite& b) {
+			int cellA = cellIndex(a.cell), cellB = cellIndex(b.cell);
+			return cellA != cellB ? cellA < cellB : a.agentId < b.agentId;
+		});
+
+		for (const SoilBite& bite : bites) {
+			if (!soil.isSoil(bite.cell.x, bite.cell.y, bite.cell.z)) {
+				bitten(bite, -1.f);
+				continue;
+			}
+			float soilNutrient = soil.nutrient(glm::vec3(bite.cell));
+			bitten(bite, soilNutrient);
+			soilNutrient -= 1;
+			if (soilNutrient <= 0) {
+				soil.setSoil(glm::vec3(bite.cell), false);
+				depletions.push_back(bite.cell);
+				soilNutrient = 0;
+			}
+			soil.setNutrient(glm::vec3(bite.cell), soilNutrient);
+		}
+	}
+
+	//the soil voxels that ran out in the last resolve, in the order they did
+	const std::vector<glm::ivec3>& depleted() const { return depletions; }
+
+private:
+	std::vector<std::pmr::vector<SoilBite>> threads;
+	std::vector<glm::ivec3> depletions;
+};
@@ -0,0 +1,69 @@
+/*
+* Walks the soil voxels crossed by a straight move through the pheromone grid (Amanatides & Woo, "A Fast Voxel Traversal Algorithm")
+* Every soil voxel the segment touches is visited once, in order, so a move can never skip over a thin wall of soil
+* The work is bounded by the number of soil voxels crossed, at most 3 * (length / PHEROMONE_RESOLUTION + 1)
+*/
+#pragma once
+#include <glm/glm.hpp>
+#include <cmath>
+#include <limits>
+#include "MultiResolution.h"
+#include "soil.h"
+
+struct SoilHit {
+	bool hit = false;
+	bool inBounds = false; //false when the move left the grid rather than running into soil
+	glm::vec3 cell = glm::vec3(0); //the soil voxel that was hit
+	glm::vec3 normal = glm::vec3(0); //outward normal of the face that was crossed to enter it
+	float distance = 0; //pheromone units travelled along the move before the hit
+};
+
+//trace a move of length pheromone units from start (a pheromone position outside soil) along the normalised direction
+inline SoilHit traceSoil(SoilGrid& soil, glm::vec3 start, glm::vec3 direction, float length) {
+	const float infinity = std::numeric_limits<float>::infinity();
+	glm::vec3 origin = start / float(PHEROMONE_RESOLUTION);
+	float soilLength = length / PHEROMONE_RESOLUTION;
+	glm::vec3 cell = glm::floor(origin);
+
+	//per axis: which way the cell index moves, how far along the move the next face is, and how far apart the faces are
+	glm::vec3 step, tMax, tDelta;
+	for (int axis = 0; axis < 3; axis++) {
+		if (direction[axis] > 0) {
+			step[axis] = 1;
+			tDelta[axis] = 1 / direction[axis];
+			tMax[axis] = (cell[axis] + 1 - origin[axis]) * tDelta[axis];
+		}
+		else if (direction[axis] < 0) {
+			step[axis] = -1;
+			tDelta[axis] = -1 / direction[axis];
+			tMax[axis] = (origin[axis] - cell[axis]) * tDelta[axis];
+		}
+		else {
+			step[axis] = 0;
+			tDelta[axis] = infinity;
+			tMax[axis] = infinity;
+		}
+	}
+
+	glm::vec3 dimensions = soil.getDimensions();
+	SoilHit result;
+	while (true) {
+		int axis = tMax.x < tMax.y ? (tMax.x < tMax.z ? 0 : 2) : (tMax.y < tMax.z ? 1 : 2);
+		float t = tMax[axis];
+		if (t > soilLength)
+			return result;
+		cell[axis] += step[axis];
+		tMax[axis] += tDelta[axis];
+
+		//isSoil is true outside the grid, so the grid walls stop a move like soil does
+		if (soil.isSoil(cell)) {
+			result.hit = true;
+			result.inBounds = cell.x >= 0 && cell.x < dimensions.x && cell.y >= 0 && cell.y < dimensions.y && cell.z >= 0 && cell.z < dimensions.z;
+			result.cell = cell;
+			result.normal = glm::vec3(0);
+			result.normal[axis] = -step[axis];
+			result.distance = t * PHEROMONE_RESOLUTION;
+			return result;
+		}
+	}
+}
@@ -0,0 +1,115 @@
+/*
+* Scratch memory that lives for one simulation step (or one rendered frame)
+* Each thread of the worker pool draws from its own sub-arena, allocating is a pointer bump and freeing does nothing.
+* reset() hands the whole arena back in O(threads) once the step is done, so containers built from it must not outlive the step
+* Requests that do not fit spill to the heap, the spill is counted so the arena can be sized from the peak usage
+*/
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <memory>
+#include <memory_resource>
+#include <vector>
+#include "settings.h"
+#include "WorkerPool.h"
+
+class ArenaResource : public std::pmr::memory_resource {
+public:
+	void attach(std::byte* _begin, size_t _size) {
+		begin = _begin;
+		size = _size;
+		offset = 0;
+	}
+
+	//bytes handed out since the last reset, including the spill
+	size_t used() const { return offset + spilled; }
+	size_t spill() const { return spilled; }
+
+	void reset() {
+		offset = 0;
+		if (spilled > 0) {
+			overflow.release();
+			spilled = 0;
+		}
+	}
+
+protected:
+	void* do_allocate(size_t bytes, size_t alignment) override {
+		size_t start = (reinterpret_cast<size_t>(begin) + offset + alignment - 1) & ~(alignment - 1);
+		start -= reinterpret_cast<size_t>(begin);
+		if (start + bytes <= size) {
+			offset = start + bytes;
+			return begin + start;
+		}
+		spilled += bytes;
+		return overflow.allocate(bytes, alignment);
+	}
+	void do_deallocate(void* memory, size_t bytes, size_t alignment) override {}
+	bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override { return this == &other; }
+
+private:
+	std::byte* begin = nullptr;
+	size_t size = 0;
+	size_t offset = 0;
+	size_t spilled = 0;
+	std::pmr::monotonic_buffer_resource overflow{ std::pmr::new_delete_resource() };
+};
+
+class StepArena {
+public:
+	StepArena(size_t _bytesPerThread, int threadCount) : bytesPerThread(_bytesPerThread), threads(threadCount) {
+		//sub-arenas start on their own cache lines so threads do not share one
+		bytesPerThread = (bytesPerThread + 63) & ~size_t(63);
+		buffer.reset(new (std::align_val_t(64)) std::byte[bytesPerThread * threadCount]);
+		for (int i = 0; i < threadCount; i++)
+			threads[i].attach(buffer.get() + bytesPerThread * i, bytesPerThread);
+	}
+	StepArena(const StepArena&) = delete;
+	StepArena& operator=(const StepArena&) = delete;
+
+	//the sub-arena of a worker pool thread (the thread argument of parallelFor), only that thread may use it
+	std::pmr::memory_resource* resource(int thread = 0) { return &threads[thread]; }
+
+	//release everything drawn from the arena. Only call it when no thread is using the arena
+	void reset() {
+		size_t used = 0;
+		for (ArenaResource& thread : threads) {
+			peakThreadBytes = std::max(peakThreadBytes, thread.used());
+			used += thread.used();
+			spillBytes = std::max(spillBytes, thread.spill());
+			thread.reset();
+		}
+		peakBytes = std::max(peakBytes, used);
+	}
+
+	size_t capacity() const { return bytesPerThread * threads.size(); }
+	//largest total usage of any step, and of any single thread in any step
+	size_t peakUsage() const { return peakBytes; }
+	size_t peakThreadUsage() const { return peakThreadBytes; }
+	//largest number of bytes a thread had to take from the heap in one step, 0 when the arena is big enough
+	size_t peakSpill() const { return spillBytes; }
+
+private:
+	struct AlignedDelete {
+		void operator()(std::byte* memory) const { ::operator delete[](memory, std::align_val_t(64)); }
+	};
+
+	size_t bytesPerThread;
+	std::unique_ptr<std::byte[], AlignedDelete> buffer;
+	std::vector<ArenaResource> threads;
+	size_t peakBytes = 0;
+	size_t peakThreadBytes = 0;
+	size_t spillBytes = 0;
+};
+
+//scratch for the simulation step, one sub-arena per worker pool thread. stepSimulation resets it when it finishes
+inline StepArena& stepArena() {
+	static StepArena arena(STEP_ARENA_BYTES, workerPool().size());
+	return arena;
+}
+
+//scratch for the render thread, reset once per frame. It is separate because frames and steps run at the same time
+inline StepArena& frameArena() {
+	static StepArena arena(STEP_ARENA_BYTES, 1);
+	return arena;
+}
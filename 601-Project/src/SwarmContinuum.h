@@ -0,0 +1,294 @@
+/*
+* Agents represented as densities on the pheromone grid instead of one by one, for colonies too big to step agent by agent
+* There are three fields per pheromone voxel: searching agents, returning agents and the nutrient the returning agents carry
+* Each step the densities flow up the gradient of what their agents look for (the same weights agents sense by) plus a little
+* diffusion for the random part of their movement, then do what agents do: searching density that runs into soil bites it and
+* turns into returning density, returning density that reaches the nest delivers its nutrient, and both deposit pheromones
+* The cost is a pass over the grid, whatever the number of agents the densities stand for
+*/
+#pragma once
+#include <glm/glm.hpp>
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <vector>
+#include "MultiResolution.h"
+#include "NestDistanceField.h"
+#include "Pheromones.h"
+#include "WorkerPool.h"
+#include "soil.h"
+
+class SwarmContinuum {
+public:
+	//size the fields for the pheromone grid, only allocates the first time (when the colony first gets big enough)
+	void prepare(glm::ivec3 _dimensions) {
+		if (dimensions == _dimensions)
+			return;
+		dimensions = _dimensions;
+		size_t volume = static_cast<size_t>(dimensions.x) * dimensions.y * dimensions.z;
+		searching.assign(volume, 0);
+		returning.assign(volume, 0);
+		carried.assign(volume, 0);
+		nextSearching.assign(volume, 0);
+		nextReturning.assign(volume, 0);
+		nextCarried.assign(volume, 0);
+		searchingVelocity.assign(volume, glm::vec3(0));
+		returningVelocity.assign(volume, glm::vec3(0));
+	}
+
+	//the number of agents the fields stand for
+	float mass() const { return total; }
+	bool isActive() const { return total > 0; }
+
+	//hand an agent over to the fields
+	void add(glm::vec3 position, bool isReturning, float nutrient) {
+		int voxel = index(glm::ivec3(position));
+		if (isReturning) {
+			returning[voxel] += 1;
+			carried[voxel] += nutrient;
+		}
+		else
+			searching[voxel] += 1;
+		total += 1;
+	}
+
+	/*
+	* Move the densities one step and let them interact with the soil, the nest and the pheromones
+	* sense(pos) gives the (searching, returning) weights at a pheromone voxel, the densities move at up to moveSpeed voxels a step
+	* Returns the nutrient delivered to the nest
+	*/
+	template <typename F>
+	float advance(VoxelGrid<PheromoneVoxel>& pheromones, SoilGrid& soil, NestDistanceField& nestDistance, glm::vec3 nestMin, glm::vec3 nestMax,
+		const F& sense, float moveSpeed) {
+		if (total <= 0)
+			return 0;
+		computeVelocities(soil, sense, moveSpeed);
+		biteSoil(soil, nestDistance);
+		flow(soil);
+
+		//returning density in the nest delivers its nutrient and starts searching again
+		float delivered = 0;
+		glm::ivec3 low = glm::max(glm::ivec3(glm::ceil(nestMin)), glm::ivec3(0));
+		glm::ivec3 high = glm::min(glm::ivec3(glm::floor(nestMax)), dimensions - 1);
+		for (int z = low.z; z <= high.z; z++)
+			for (int y = low.y; y <= high.y; y++)
+				for (int x = low.x; x <= high.x; x++) {
+					int voxel = index(glm::ivec3(x, y, z));
+					delivered += returning[voxel];
+					searching[voxel] += returning[voxel];
+					returning[voxel] = 0;
+					carried[voxel] = 0;
+				}
+
+		//deposit like the agents would: wander pheromone while searching, the carried nutrient as food pheromone while returning
+		//the whole pass holds the pheromone lock once rather than once per voxel
+		total = 0;
+		depositPheromones(pheromones, [&](const auto& deposit) {
+			for (int z = 0; z < dimensions.z; z++)
+				for (int y = 0; y < dimensions.y; y++)
+					for (int x = 0; x < dimensions.x; x++) {
+						int voxel = index(glm::ivec3(x, y, z));
+						if (searching[voxel] <= 0 && returning[voxel] <= 0)
+							continue;
+						glm::vec3 position(x, y, z);
+						if (searching[voxel] > 0)
+							deposit(position, PheromoneVoxel::Wander, 5 * searching[voxel]);
+						if (carried[voxel] > 0)
+							deposit(position, PheromoneVoxel::Food, carried[voxel]);
+						total += searching[voxel] + returning[voxel];
+					}
+		});
+		return delivered;
+	}
+
+	//add new searching density at a position (the nest spawning)
+	void spawn(glm::vec3 position, float amount) {
+		searching[index(glm::ivec3(position))] += amount;
+		total += amount;
+	}
+
+	/*
+	* Turn density at the edge of the fields back into agents, so the colony's frontier keeps exploring as individuals
+	* A voxel is on the edge when it holds at least one agent's worth and some open neighbour is (almost) empty
+	* emit(position, isReturning, nutrient) is called once for every agent taken out, at most one per voxel per step
+	*/
+	template <typename F>
+	void emitFrontier(SoilGrid& soil, float edgeDensity, const F& emit) {
+		if (total <= 0)
+			return;
+		for (int z = 0; z < dimensions.z; z++)
+			for (int y = 0; y < dimensions.y; y++)
+				for (int x = 0; x < dimensions.x; x++) {
+					glm::ivec3 cell(x, y, z);
+					int voxel = index(cell);
+					bool isReturning = returning[voxel] >= 1;
+					if (!isReturning && searching[voxel] < 1)
+						continue;
+					bool edge = false;
+					for (glm::ivec3 offset : faceOffsets()) {
+						glm::ivec3 neighbour = cell + offset;
+						if (isOpen(soil, neighbour) && searching[index(neighbour)] + returning[index(neighbour)] < edgeDensity) {
+							edge = true;
+							break;
+						}
+					}
+					if (!edge)
+						continue;
+					float nutrient = 0;
+					if (isReturning) {
+						nutrient = carried[voxel] / returning[voxel];
+						carried[voxel] -= nutrient;
+						returning[voxel] -= 1;
+					}
+					else
+						searching[voxel] -= 1;
+					total -= 1;
+					emit(glm::vec3(cell) + 0.5f, isReturning, nutrient);
+				}
+	}
+
+private:
+	static const std::array<glm::ivec3, 6>& faceOffsets() {
+		static const std::array<glm::ivec3, 6> offsets = { glm::ivec3(1, 0, 0), glm::ivec3(-1, 0, 0), glm::ivec3(0, 1, 0),
+			glm::ivec3(0, -1, 0), glm::ivec3(0, 0, 1), glm::ivec3(0, 0, -1) };
+		return offsets;
+	}
+
+	int index(glm::ivec3 voxel) const { return voxel.x + dimensions.x * (voxel.y + dimensions.y * voxel.z); }
+
+	bool inside(glm::ivec3 voxel) const {
+		return voxel.x >= 0 && voxel.y >= 0 && voxel.z >= 0 && voxel.x < dimensions.x && voxel.y < dimensions.y && voxel.z < dimensions.z;
+	}
+
+	bool isOpen(SoilGrid& soil, glm::ivec3 voxel) const {
+		return inside(voxel) && !soil.isSoil(soilCellOf(glm::vec3(voxel)));
+	}
+
+	//velocity up the central difference of the sensed weights, for the voxels that hold density
+	template <typename F>
+	void computeVelocities(SoilGrid& soil, const F& sense, float moveSpeed) {
+		workerPool().parallelFor(dimensions.z, [&](int zBegin, int zEnd, int thread) {
+			for (int z = zBegin; z < zEnd; z++)
+				for (int y = 0; y < dimensions.y; y++)
+					for (int x = 0; x < dimensions.x; x++) {
+						glm::ivec3 cell(x, y, z);
+						int voxel = index(cell);
+						if (searching[voxel] <= 0 && returning[voxel] <= 0)
+							continue;
+						glm::vec3 searchingGradient(0), returningGradient(0);
+						for (int axis = 0; axis < 3; axis++) {
+							glm::ivec3 step(0);
+							step[axis] = 1;
+							glm::vec2 difference = sense(glm::vec3(glm::min(cell + step, dimensions - 1))) - sense(glm::vec3(glm::max(cell - step, glm::ivec3(0))));
+							searchingGradient[axis] = difference.x;
+							returningGradient[axis] = difference.y;
+						}
+						searchingVelocity[voxel] = glm::length(searchingGradient) > 1e-6f ? glm::normalize(searchingGradient) * moveSpeed : glm::vec3(0);
+						returningVelocity[voxel] = glm::length(returningGradient) > 1e-6f ? glm::normalize(returningGradient) * moveSpeed : glm::vec3(0);
+					}
+		});
+	}
+
+	//searching density heading into soil bites it, like an agent colliding with it
+	void biteSoil(SoilGrid& soil, NestDistanceField& nestDistance) {
+		glm::ivec3 soilDimensions = glm::ivec3(soil.getDimensions());
+		for (int z = 0; z < dimensions.z; z++)
+			for (int y = 0; y < dimensions.y; y++)
+				for (int x = 0; x < dimensions.x; x++) {
+					glm::ivec3 cell(x, y, z);
+					int voxel = index(cell);
+					glm::vec3 velocity = searchingVelocity[voxel];
+					if (searching[voxel] <= 0 || velocity == glm::vec3(0))
+						continue;
+					int axis = std::abs(velocity.x) >= std::abs(velocity.y) ? (std::abs(velocity.x) >= std::abs(velocity.z) ? 0 : 2) : (std::abs(velocity.y) >= std::abs(velocity.z) ? 1 : 2);
+					glm::ivec3 ahead = cell;
+					ahead[axis] += velocity[axis] > 0 ? 1 : -1;
+					glm::ivec3 soilCell = glm::ivec3(soilCellOf(glm::vec3(ahead)));
+					if (!inside(ahead) || glm::any(glm::lessThan(soilCell, glm::ivec3(0))) || glm::any(glm::greaterThanEqual(soilCell, soilDimensions)) || !soil.isSoil(soilCell.x, soilCell.y, soilCell.z))
+						continue;
+
+					//each agent's worth that bites takes one unit of nutrient and carries 5 times what the soil held
+					float biting = std::min(searching[voxel] * std::abs(velocity[axis]), searching[voxel]);
+					float soilNutrient = soil.nutrient(glm::vec3(soilCell));
+					searching[voxel] -= biting;
+					returning[voxel] += biting;
+					carried[voxel] += biting * soilNutrient * 5;
+					soilNutrient -= biting;
+					if (soilNutrient <= 0) {
+						soil.setSoil(glm::vec3(soilCell), false);
+						nestDistance.opened(soil, soilCell);
+						soilNutrient = 0;
+					}
+					soil.setNutrient(glm::vec3(soilCell), soilNutrient);
+				}
+	}
+
+	//the part of a voxel's density that moves to each face neighbour this step, along its velocity plus diffusion
+	//faces that lead into soil or out of the grid get nothing, if more than all of it would leave the parts are scaled down
+	void outflow(SoilGrid& soil, glm::ivec3 cell, glm::vec3 velocity, float fractions[6]) const {
+		const float diffusion = 0.05;
+		float sum = 0;
+		for (int face = 0; face < 6; face++) {
+			glm::ivec3 offset = faceOffsets()[face];
+			fractions[face] = isOpen(soil, cell + offset) ? std::max(glm::dot(velocity, glm::vec3(offset)), 0.f) + diffusion : 0;
+			sum += fractions[face];
+		}
+		if (sum > 1)
+			for (int face = 0; face < 6; face++)
+				fractions[face] /= sum;
+	}
+
+	//first order upwind transport, gathered per voxel so slabs of the grid can be done in parallel
+	void flow(SoilGrid& soil) {
+		workerPool().parallelFor(dimensions.z, [&](int zBegin, int zEnd, int thread) {
+			float fractions[6];
+			for (int z = zBegin; z < zEnd; z++)
+				for (int y = 0; y < dimensions.y; y++)
+					for (int x = 0; x < dimensions.x; x++) {
+						glm::ivec3 cell(x, y, z);
+						int voxel = index(cell);
+						float s = 0, r = 0, c = 0;
+						if (searching[voxel] > 0 || returning[voxel] > 0) {
+							float searchingStays = 1, returningStays = 1;
+							outflow(soil, cell, searchingVelocity[voxel], fractions);
+							for (float fraction : fractions)
+								searchingStays -= fraction;
+							outflow(soil, cell, returningVelocity[voxel], fractions);
+							for (float fraction : fractions)
+								returningStays -= fraction;
+							s = searching[voxel] * searchingStays;
+							r = returning[voxel] * returningStays;
+							c = carried[voxel] * returningStays;
+						}
+						//what flows in from each neighbour, through the face opposite the one it leaves by
+						for (int face = 0; face < 6; face++) {
+							glm::ivec3 from = cell - faceOffsets()[face];
+							if (!inside(from))
+								continue;
+							int neighbour = index(from);
+							if (searching[neighbour] > 0) {
+								outflow(soil, from, searchingVelocity[neighbour], fractions);
+								s += searching[neighbour] * fractions[face];
+							}
+							if (returning[neighbour] > 0) {
+								outflow(soil, from, returningVelocity[neighbour], fractions);
+								r += returning[neighbour] * fractions[face];
+								c += carried[neighbour] * fractions[face];
+							}
+						}
+						nextSearching[voxel] = s;
+						nextReturning[voxel] = r;
+						nextCarried[voxel] = c;
+					}
+		});
+		searching.swap(nextSearching);
+		returning.swap(nextReturning);
+		carried.swap(nextCarried);
+	}
+
+	glm::ivec3 dimensions = glm::ivec3(0);
+	float total = 0;
+	std::vector<float> searching, returning, carried;
+	std::vector<float> nextSearching, nextReturning, nextCarried;
+	std::vector<glm::vec3> searchingVelocity, returningVelocity;
+};
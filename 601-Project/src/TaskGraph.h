@@ -0,0 +1,247 @@
+/*
+* A simulation step as a graph of tasks, run on the worker pool with work stealing
+* A node is a loop over count items, cut into chunks like parallelFor. Once every node it depends on has finished, its chunks are
+* pushed onto the deque of the thread that finished the last of them. Threads take work from the back of their own deque and
+* steal from the front of the others' when it is empty, so independent nodes run at the same time and a thread left with
+* nothing to do helps whoever has the most. A thread that finds every deque empty sleeps until more chunks are queued or the
+* graph is done, rather than spinning while a long chunk holds up the nodes after it. Every node records how long its chunks ran (busy) and from its first start to its
+* last finish (span). The graph is rebuilt every step without allocating, node bodies are held by pointer like the pool's loops
+*/
+#pragma once
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <stdexcept>
+#include <vector>
+#include "settings.h"
+#include "WorkerPool.h"
+
+struct TaskTiming {
+	const char* name = "";
+	float busy = 0; //ms, summed over the node's chunks
+	float span = 0; //ms, from the node's first chunk starting to its last one finishing
+	int chunks = 0;
+};
+
+class TaskGraph {
+public:
+	static const int MAX_NODES = 32;
+	static const int MAX_DEPENDENTS = 8;
+
+	TaskGraph() : deques(NUMBER_WORKER_THREADS) {}
+	TaskGraph(const TaskGraph&) = delete;
+	TaskGraph& operator=(const TaskGraph&) = delete;
+
+	//forget the last step's nodes, their timings stay readable until the next run
+	void clear() { nodeTotal = 0; }
+
+	//a node that calls fn(begin, end, thread) over chunks of [0, count). A count of 0 runs nothing but still orders its dependents
+	//fn must stay alive until run() returns and must not call parallelFor. The node arrays are fixed, going over them throws
+	template <typename F>
+	int add(const char* name, int count, const F& fn) {
+		if (nodeTotal >= MAX_NODES)
+			throw std::length_error("task graph has more than MAX_NODES nodes");
+		Node& node = nodes[nodeTotal];
+		node.name = name;
+		node.count = count;
+		node.job = &fn;
+		node.invoke = &TaskGraph::invokeChunk<F>;
+		node.dependencies = 0;
+		node.dependentCount = 0;
+		return nodeTotal++;
+	}
+
+	//after cannot start before before has finished
+	void precede(int before, int after) {
+		if (nodes[before].dependentCount >= MAX_DEPENDENTS)
+			throw std::length_error("task graph node has more than MAX_DEPENDENTS dependents");
+		nodes[before].dependents[nodes[before].dependentCount++] = after;
+		nodes[after].dependencies++;
+	}
+
+	//run every node and return once all have finished, the caller takes part as thread 0
+	void run() {
+		runStart = std::chrono::steady_clock::now();
+		remainingNodes = nodeTotal;
+		queuedChunks = 0;
+		for (int n = 0; n < nodeTotal; n++) {
+			Node& node = nodes[n];
+			node.pending = node.dependencies;
+			node.busyNanoseconds = 0;
+			node.firstStart = -1;
+			node.lastEnd = 0;
+			node.chunkTotal = 0;
+		}
+		for (int n = 0; n < nodeTotal; n++) {
+			if (nodes[n].dependencies == 0)
+				release(n, 0);
+		}
+		workerPool().parallelFor(workerPool().size(), [this](int begin, int end, int thread) { work(thread); });
+		for (int n = 0; n < nodeTotal; n++) {
+			Node& node = nodes[n];
+			timings[n].name = node.name;
+			timings[n].busy = node.busyNanoseconds.load() / 1e6f;
+			timings[n].span = node.firstStart.load() < 0 ? 0 : (node.lastEnd.load() - node.firstStart.load()) / 1e6f;
+			timings[n].chunks = node.chunkTotal;
+		}
+		timedNodes = nodeTotal;
+	}
+
+	int timingCount() const { return timedNodes; }
+	const TaskTiming& timing(int node) const { return timings[node]; }
+
+private:
+	struct Node {
+		const char* name = "";
+		int count = 0;
+		const void* job = nullptr;
+		void (*invoke)(const void*, int, int, int) = nullptr;
+		std::array<int, MAX_DEPENDENTS> dependents;
+		int dependentCount = 0;
+		int dependencies = 0;
+		int chunkTotal = 0;
+		std::atomic<int> pending{ 0 }; //dependencies that have not finished
+		std::atomic<int> remainingChunks{ 0 };
+		std::atomic<long long> busyNanoseconds{ 0 };
+		std::atomic<long long> firstStart{ -1 }; //ns since the run started
+		std::atomic<long long> lastEnd{ 0 };
+	};
+
+	struct Chunk {
+		int node;
+		int begin;
+		int end;
+	};
+
+	//a fixed size ring of chunks, the owner pushes and pops at the back and thieves take from the front
+	struct Deque {
+		static const int CAPACITY = MAX_NODES * NUMBER_WORKER_THREADS * 8;
+		std::mutex lock;
+		std::array<Chunk, CAPACITY> chunks;
+		int head = 0; //front, the oldest chunk
+		int size = 0;
+
+		void push(const Chunk& chunk) {
+			std::lock_guard<std::mutex> guard(lock);
+			//a worker throwing ends the program, which beats overwriting queued chunks
+			if (size == CAPACITY)
+				throw std::length_error("task graph deque is full");
+			chunks[(head + size) % CAPACITY] = chunk;
+			size++;
+		}
+		bool pop(Chunk& chunk) {
+			std::lock_guard<std::mutex> guard(lock);
+			if (size == 0)
+				return false;
+			size--;
+			chunk = chunks[(head + size) % CAPACITY];
+			return true;
+		}
+		bool steal(Chunk& chunk) {
+			std::lock_guard<std::mutex> guard(lock);
+			if (size == 0)
+				return false;
+			chunk = chunks[head];
+			head = (head + 1) % CAPACITY;
+			size--;
+			return true;
+		}
+	};
+
+	template <typename F>
+	static void invokeChunk(const void* fn, int begin, int end, int thread) {
+		(*static_cast<const F*>(fn))(begin, end, thread);
+	}
+
+	long long sinceStart() const {
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - runStart).count();
+	}
+
+	//all of a node's dependencies are done: queue its chunks on this thread, same chunking as parallelFor
+	void release(int n, int thread) {
+		Node& node = nodes[n];
+		if (node.count <= 0) {
+			finish(n, thread);
+			return;
+		}
+		int chunkSize = node.count / (workerPool().size() * 4) > 0 ? node.count / (workerPool().size() * 4) : 1;
+		node.chunkTotal = (node.count + chunkSize - 1) / chunkSize;
+		node.remainingChunks.store(node.chunkTotal, std::memory_order_relaxed);
+		//pushed last to first so the owner, popping from the back, starts at the beginning of the range
+		for (int chunk = node.chunkTotal - 1; chunk >= 0; chunk--) {
+			int begin = chunk * chunkSize;
+			deques[thread].push(Chunk{ n, begin, begin + chunkSize < node.count ? begin + chunkSize : node.count });
+		}
+		queuedChunks.fetch_add(node.chunkTotal, std::memory_order_acq_rel);
+		wakeIdle();
+	}
+
+	//taking the lock between changing what idle threads wait on and notifying means none of them misses the change
+	void wakeIdle() {
+		{
+			std::lock_guard<std::mutex> guard(idleLock);
+		}
+		idle.notify_all();
+	}
+
+	void finish(int n, int thread) {
+		Node& node = nodes[n];
+		for (int d = 0; d < node.dependentCount; d++) {
+			if (nodes[node.dependents[d]].pending.fetch_sub(1, std::memory_order_acq_rel) == 1)
+				release(node.dependents[d], thread);
+		}
+		if (remainingNodes.fetch_sub(1, std::memory_order_acq_rel) == 1)
+			wakeIdle();
+	}
+
+	void execute(const Chunk& chunk, int thread) {
+		Node& node = nodes[chunk.node];
+		long long start = sinceStart();
+		long long expected = -1;
+		node.firstStart.compare_exchange_strong(expected, start, std::memory_order_relaxed);
+		node.invoke(node.job, chunk.begin, chunk.end, thread);
+		long long end = sinceStart();
+		node.busyNanoseconds.fetch_add(end - start, std::memory_order_relaxed);
+		long long last = node.lastEnd.load(std::memory_order_relaxed);
+		while (end > last && !node.lastEnd.compare_exchange_weak(last, end, std::memory_order_relaxed)) {}
+		if (node.remainingChunks.fetch_sub(1, std::memory_order_acq_rel) == 1)
+			finish(chunk.node, thread);
+	}
+
+	void work(int thread) {
+		int threads = workerPool().size();
+		while (remainingNodes.load(std::memory_order_acquire) > 0) {
+			Chunk chunk;
+			bool found = deques[thread].pop(chunk);
+			for (int i = 1; !found && i < threads; i++)
+				found = deques[(thread + i) % threads].steal(chunk);
+			if (found) {
+				queuedChunks.fetch_sub(1, std::memory_order_acq_rel);
+				execute(chunk, thread);
+			}
+			else {
+				std::unique_lock<std::mutex> guard(idleLock);
+				idle.wait(guard, [this] { return queuedChunks.load(std::memory_order_acquire) > 0 || remainingNodes.load(std::memory_order_acquire) == 0; });
+			}
+		}
+	}
+
+	std::array<Node, MAX_NODES> nodes;
+	int nodeTotal = 0;
+	std::vector<Deque> deques; //one per pool thread
+	std::atomic<int> remainingNodes{ 0 };
+	std::atomic<int> queuedChunks{ 0 }; //chunks pushed and not yet taken
+	std::mutex idleLock;
+	std::condition_variable idle;
+	std::chrono::steady_clock::time_point runStart;
+	std::array<TaskTiming, MAX_NODES> timings;
+	int timedNodes = 0;
+};
+
+//the graph the simulation step is built in, rebuilt every step
+inline TaskGraph& stepGraph() {
+	static TaskGraph graph;
+	return graph;
+}
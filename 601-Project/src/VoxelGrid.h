@@ -1,40 +1,88 @@
 /*
 * A file that contains necessary functions and classes for contining data in a voxel based grid
-* indexing starts with 0 at (0,0,0) then increases first along the x, then the y, then the z
+* The grid is split into bricks of BRICK_SIZE^3 voxels that are stored contiguously. Inside a brick indexing starts with 0 at (0,0,0)
+* then increases first along the x, then the y, then the z. The bricks themselves are ordered the same way
+* Grids that do not divide evenly into bricks are padded, the padding voxels are never returned by indexToPos
 */
 #pragma once
 #include <glm/glm.hpp>
-#include <set>
+#include <algorithm>
 #include <stdexcept>
 #include <iostream>
 #include <mutex>
+#include <memory>
+#include <string>
+#include <vector>
+#include <type_traits>
+#include "GridStorage.h"
+#include "WorkerPool.h"
+#include "VoxelSet.h"
 
 template <typename T>
 class VoxelGrid  {
+	static_assert(std::is_trivially_copyable<T>::value, "voxel data must be trivially copyable so it can be mapped from a world file");
 public:
-	VoxelGrid(int x_length, int y_length, int z_length);
-	~VoxelGrid();
+	static const int BRICK_SIZE = 8;
+	static const int BRICK_VOLUME = BRICK_SIZE * BRICK_SIZE * BRICK_SIZE;
+
+	VoxelGrid(int x_length, int y_length, int z_length, GridAllocation allocation = GridAllocation());
+	//map the grid from a world file instead of the heap. If the file does not exist it is created with default voxels
+	VoxelGrid(int x_length, int y_length, int z_length, const std::string& worldFile);
 	T& at(int x, int y, int z);
 	T& at(glm::vec3);
 	T& at(int _index);
+	//access a voxel without marking it occupied, for grids that do not use the occupied set
+	T& peek(int _index);
+	//the voxels in brick order, for readers that do their own indexing. Nothing read through it is marked occupied
+	const T* voxels() { return data; }
 	glm::vec3 indexToPos(int _index);
 	int posToIndex(glm::vec3 position);
+	//the index of (x, y, z) is xOffset(x) + yOffset(y) + zOffset(z), so loops over a box can work out each axis once
+	int xOffset(int x) { return x / BRICK_SIZE * BRICK_VOLUME + x % BRICK_SIZE; }
+	int yOffset(int y) { return y / BRICK_SIZE * bricks_x * BRICK_VOLUME + y % BRICK_SIZE * BRICK_SIZE; }
+	int zOffset(int z) { return z / BRICK_SIZE * bricks_x * bricks_y * BRICK_VOLUME + z % BRICK_SIZE * BRICK_SIZE * BRICK_SIZE; }
 	void markUnoccupied(int _index);
 	void markUnoccupied(glm::vec3 position);
-	const std::set<int>& getOccupiedMap() { return occupied; };
+	const VoxelSet& getOccupiedMap() { return occupied; };
 	glm::vec3 getDimensions();
+	int getBrickCount() { return bricks_x * bricks_y * bricks_z; }
+	int brickOf(int _index) { return _index / BRICK_VOLUME; }
+	//position of the voxel with the lowest coordinates in a brick
+	glm::vec3 brickOrigin(int brick) { return indexToPos(brick * BRICK_VOLUME); }
+	//remove every voxel of a brick from the occupied set
+	void markBrickUnoccupied(int brick);
+	//true if the voxels were read from an existing world file and do not need to be generated
+	bool isLoadedFromFile() { return storage.loadedFromFile(); }
+	//call once the voxels of a mapped grid are generated, a world file is only loaded again after this
+	void markComplete() { storage.markComplete(); }
+	//add the bricks overlapping the box of voxels [low, high] to the active region, the bricks the simulation is working in
+	void markActive(glm::ivec3 low, glm::ivec3 high);
+	//one flag per brick, set for the bricks marked active since the last residency hint
+	const unsigned char* activeBricks() { return brickActive.get(); }
+	//hint to the OS that the active region will be used and the rest may be paged out (mapped grids only), then clear the region
+	void adviseResidency();
+
 
-	
 
 private:
+	void initialize();
+	int voxelIndex(int x, int y, int z);
+
 	//how many voxels are along each axis
 	int x_length = 0;
 	int y_length = 0;
 	int z_length = 0;
 
+	//how many bricks are along each axis
+	int bricks_x = 0;
+	int bricks_y = 0;
+	int bricks_z = 0;
+
+	GridStorage storage;
 	T* data = nullptr;
-	std::set<int> occupied;
-	
+	VoxelSet occupied;
+	std::unique_ptr<unsigned char[]> brickActive;
+
 };
 
 //definitions
@@ -42,25 +90,26 @@ private:
 template <class T>
 T& VoxelGrid<T>::at(int _index) {
 	if (_index < 0) {
-		std::cout << "Negative index provided: " << _index << '\n' << std::fflush;
-		throw std::exception("Negative index provided");
+		std::cout << "Negative index provided: " << _index << '\n' << std::flush;
+		throw std::out_of_range("Negative index provided");
 	}
-	if (_index > (x_length * y_length * z_length) - 1) {
-		std::cout << "out of bounds index provided: " << _index << '\n' << std::fflush;
-		throw std::exception("out of bounds index provided");
+	if (_index > (getBrickCount() * BRICK_VOLUME) - 1) {
+		std::cout << "out of bounds index provided: " << _index << '\n' << std::flush;
+		throw std::out_of_range("out of bounds index provided");
 	}
 	//mark that cell as occupied since the voxel is in use
 	occupied.insert(_index);
 	return data[_index];
 }
 
+template <class T>
+T& VoxelGrid<T>::peek(int _index) {
+	return data[_index];
+}
+
 template <class T>
 T& VoxelGrid<T>::at(int _x, int _y, int _z) {
-	int offset_z = y_length * x_length * _z;
-	int offset_y = x_length * _y;
-	int offset_x = _x;
-	int index = offset_x + offset_y + offset_z;
-	return at(index);
+	return at(voxelIndex(_x, _y, _z));
 }
 
 template <class T>
@@ -70,21 +119,29 @@ T& VoxelGrid<T>::at(glm::vec3 _pos) {
 
 template <class T>
 glm::vec3 VoxelGrid<T>::indexToPos(int _index) {
-	int z = floor(_index / (x_length * y_length));
-	_index -= z * x_length * y_length;
-	int y = floor(_index / x_length);
-	_index -= y * x_length;
-	int x = _index;
-	return glm::vec3(x, y, z);
+	int brick = _index / BRICK_VOLUME;
+	int local = _index % BRICK_VOLUME;
+	int bz = brick / (bricks_x * bricks_y);
+	brick -= bz * bricks_x * bricks_y;
+	int by = brick / bricks_x;
+	int bx = brick - by * bricks_x;
+	int z = local / (BRICK_SIZE * BRICK_SIZE);
+	local -= z * BRICK_SIZE * BRICK_SIZE;
+	int y = local / BRICK_SIZE;
+	int x = local - y * BRICK_SIZE;
+	return glm::vec3(bx * BRICK_SIZE + x, by * BRICK_SIZE + y, bz * BRICK_SIZE + z);
 }
 
 template <class T>
 int VoxelGrid<T>::posToIndex(glm::vec3 pos) {
-	int offset_z = y_length * x_length * pos.z;
-	int offset_y = x_length * pos.y;
-	int offset_x = pos.x;
-	int index = offset_x + offset_y + offset_z;
-	return index;
+	return voxelIndex(pos.x, pos.y, pos.z);
+}
+
+template <class T>
+int VoxelGrid<T>::voxelIndex(int x, int y, int z) {
+	int brick = (z / BRICK_SIZE * bricks_y + y / BRICK_SIZE) * bricks_x + x / BRICK_SIZE;
+	int local = ((z % BRICK_SIZE) * BRICK_SIZE + y % BRICK_SIZE) * BRICK_SIZE + x % BRICK_SIZE;
+	return brick * BRICK_VOLUME + local;
 }
 
 template <class T>
@@ -98,15 +155,56 @@ void VoxelGrid<T>::markUnoccupied(glm::vec3 pos) {
 }
 
 template <class T>
-VoxelGrid<T>::VoxelGrid(int _x_length, int _y_length, int _z_length) : x_length(_x_length), y_length(_y_length), z_length(_z_length) {
-	// Initialize your voxel grid based on the provided dimensions
-	data = new T[_x_length * _y_length * _z_length];  // Allocate memory for the voxel grid
-	std::cout << "Set can contain " << occupied.max_size() << " entries\n";
+void VoxelGrid<T>::markBrickUnoccupied(int brick) {
+	occupied.eraseWords(brick * BRICK_VOLUME, (brick + 1) * BRICK_VOLUME);
+}
+
+template <class T>
+VoxelGrid<T>::VoxelGrid(int _x_length, int _y_length, int _z_length, GridAllocation allocation)
+	: x_length(_x_length), y_length(_y_length), z_length(_z_length),
+	bricks_x((_x_length + BRICK_SIZE - 1) / BRICK_SIZE), bricks_y((_y_length + BRICK_SIZE - 1) / BRICK_SIZE), bricks_z((_z_length + BRICK_SIZE - 1) / BRICK_SIZE),
+	storage(GridStorage::heap(sizeof(T) * getBrickCount() * BRICK_VOLUME, allocation)) {
+	initialize();
+}
+
+template <class T>
+VoxelGrid<T>::VoxelGrid(int _x_length, int _y_length, int _z_length, const std::string& worldFile)
+	: x_length(_x_length), y_length(_y_length), z_length(_z_length),
+	bricks_x((_x_length + BRICK_SIZE - 1) / BRICK_SIZE), bricks_y((_y_length + BRICK_SIZE - 1) / BRICK_SIZE), bricks_z((_z_length + BRICK_SIZE - 1) / BRICK_SIZE),
+	storage(GridStorage::mapped(worldFile, WorldFileHeader{ {'V','O','X','E','L','S','0','1'}, sizeof(T), BRICK_SIZE, _x_length, _y_length, _z_length }, sizeof(T) * getBrickCount() * BRICK_VOLUME)) {
+	initialize();
+}
+
+template <class T>
+void VoxelGrid<T>::initialize() {
+	data = static_cast<T*>(storage.data());
+	//a world file that already existed holds valid voxels, anything else starts with default constructed voxels
+	//the bricks are constructed by the worker pool, so the pages of a large grid are faulted in by every thread at once instead of
+	//one. The pool hands out chunks dynamically, so this says nothing about which thread sweeps a page later
+	if (!storage.loadedFromFile()) {
+		workerPool().parallelFor(getBrickCount(), [this](int begin, int end, int thread) {
+			std::uninitialized_value_construct_n(data + begin * BRICK_VOLUME, (end - begin) * BRICK_VOLUME);
+		});
+	}
+	brickActive.reset(new unsigned char[getBrickCount()]());
+	occupied.resize(getBrickCount() * BRICK_VOLUME);
+	std::cout << "Set can contain " << occupied.capacity() << " entries\n";
+}
+
+template <class T>
+void VoxelGrid<T>::markActive(glm::ivec3 low, glm::ivec3 high) {
+	glm::ivec3 lowBrick = glm::max(low, glm::ivec3(0)) / BRICK_SIZE;
+	glm::ivec3 highBrick = glm::min(high, glm::ivec3(x_length, y_length, z_length) - 1) / BRICK_SIZE;
+	for (int z = lowBrick.z; z <= highBrick.z; z++)
+		for (int y = lowBrick.y; y <= highBrick.y; y++)
+			for (int x = lowBrick.x; x <= highBrick.x; x++)
+				brickActive[x + bricks_x * (y + bricks_y * z)] = 1;
 }
 
 template <class T>
-VoxelGrid<T>::~VoxelGrid() {
-	delete[] data;  // Free the allocated memory in the destructor
+void VoxelGrid<T>::adviseResidency() {
+	storage.adviseBricks(brickActive.get(), getBrickCount(), sizeof(T) * BRICK_VOLUME);
+	std::fill(brickActive.get(), brickActive.get() + getBrickCount(), 0);
 }
 
 template <class T>
@@ -0,0 +1,117 @@
+/*
+* A set of voxel indices stored as one bit per voxel of a grid
+* Unlike std::set it never allocates after it is sized, inserting and erasing are O(1) and iterating
+* visits the indices in increasing order while skipping empty words, so a whole brick of absent voxels costs a few word reads
+*/
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+//number of the lowest set bit, bits must not be 0
+inline int lowestSetBit(std::uint64_t bits) {
+#ifdef _MSC_VER
+	unsigned long index;
+	_BitScanForward64(&index, bits);
+	return static_cast<int>(index);
+#else
+	return __builtin_ctzll(bits);
+#endif
+}
+
+inline int countSetBits(std::uint64_t bits) {
+#ifdef _MSC_VER
+	return static_cast<int>(__popcnt64(bits));
+#else
+	return __builtin_popcountll(bits);
+#endif
+}
+
+class VoxelSet {
+public:
+	class iterator {
+	public:
+		iterator(const VoxelSet* _set, int _word) : set(_set), word(_word) { advance(); }
+		int operator*() const { return word * 64 + lowestSetBit(bits); }
+		iterator& operator++() {
+			bits &= bits - 1;
+			if (bits == 0) {
+				word++;
+				advance();
+			}
+			return *this;
+		}
+		bool operator!=(const iterator& other) const { return word != other.word || bits != other.bits; }
+
+	private:
+		//move to the next word with a bit set (or the end). The bits of a word are read once, when it is entered
+		void advance() {
+			int wordCount = static_cast<int>(set->words.size());
+			while (word < wordCount && set->words[word] == 0)
+				word++;
+			bits = word < wordCount ? set->words[word] : 0;
+		}
+
+		const VoxelSet* set;
+		int word;
+		std::uint64_t bits = 0;
+	};
+
+	VoxelSet() = default;
+	explicit VoxelSet(int capacity) { resize(capacity); }
+
+	//make room for indices [0, capacity), the set is emptied
+	void resize(int capacity) {
+		words.assign((capacity + 63) / 64, 0);
+		count = 0;
+	}
+	int capacity() const { return static_cast<int>(words.size()) * 64; }
+	int size() const { return count; }
+	bool empty() const { return count == 0; }
+
+	bool contains(int index) const { return (words[index >> 6] >> (index & 63)) & 1; }
+	void insert(int index) {
+		std::uint64_t bit = std::uint64_t(1) << (index & 63);
+		if ((words[index >> 6] & bit) == 0) {
+			words[index >> 6] |= bit;
+			count++;
+		}
+	}
+	void erase(int index) {
+		std::uint64_t bit = std::uint64_t(1) << (index & 63);
+		if (words[index >> 6] & bit) {
+			words[index >> 6] &= ~bit;
+			count--;
+		}
+	}
+	//erase [begin, end), both multiples of 64
+	void eraseWords(int begin, int end) {
+		for (int word = begin / 64; word < end / 64; word++) {
+			count -= countSetBits(words[word]);
+			words[word] = 0;
+		}
+	}
+	//call fn(index) for every index in [begin, end) in order, both multiples of 64
+	template <typename F>
+	void forEachIn(int begin, int end, const F& fn) const {
+		for (int word = begin / 64; word < end / 64; word++) {
+			for (std::uint64_t bits = words[word]; bits != 0; bits &= bits - 1)
+				fn(word * 64 + lowestSetBit(bits));
+		}
+	}
+	void clear() {
+		std::fill(words.begin(), words.end(), 0);
+		count = 0;
+	}
+
+	iterator begin() const { return iterator(this, 0); }
+	iterator end() const { return iterator(this, static_cast<int>(words.size())); }
+
+private:
+	std::vector<std::uint64_t> words;
+	int count = 0;
+};
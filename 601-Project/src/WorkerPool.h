@@ -0,0 +1,153 @@
+/*
+* A fixed set of threads that the simulation hands data parallel loops to
+* The calling thread takes part in every loop, so NUMBER_WORKER_THREADS threads run in total
+* Dispatching a loop does not allocate, the loop body is passed to the workers by pointer
+*/
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "settings.h"
+
+#if defined(__linux__)
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+class WorkerPool {
+public:
+	explicit WorkerPool(int threadCount);
+	~WorkerPool();
+	WorkerPool(const WorkerPool&) = delete;
+	WorkerPool& operator=(const WorkerPool&) = delete;
+
+	//number of threads that take part in a loop, including the caller
+	int size() const { return static_cast<int>(workers.size()) + 1; }
+	//the operating system's ids of the pool's own threads (linux thread ids, -1 elsewhere), for profiling all of them
+	const std::vector<int>& workerThreadIds() const { return threadIds; }
+
+	//call fn(begin, end, thread) over chunks of [0, count). thread is in [0, size()) and unique among the concurrently running chunks
+	//the loop body must not call parallelFor itself
+	template <typename F>
+	void parallelFor(int count, const F& fn);
+
+private:
+	void work(int thread);
+	void workerLoop(int thread);
+
+	template <typename F>
+	static void invokeChunk(const void* fn, int begin, int end, int thread) {
+		(*static_cast<const F*>(fn))(begin, end, thread);
+	}
+
+	std::vector<std::thread> workers;
+	std::vector<int> threadIds;
+	std::mutex dispatch; //only one loop runs on the pool at a time
+	std::mutex lock;
+	std::condition_variable wake;
+	std::condition_variable finished;
+
+	//the loop currently being run
+	const void* job = nullptr;
+	void (*invoke)(const void*, int, int, int) = nullptr;
+	int jobCount = 0;
+	int chunkSize = 1;
+	std::atomic<int> nextChunk{ 0 };
+	int generation = 0;
+	int running = 0;
+	int startedWorkers = 0;
+	bool stopping = false;
+};
+
+//definitions
+
+inline WorkerPool::WorkerPool(int threadCount) {
+	threadIds.assign(threadCount > 1 ? threadCount - 1 : 0, -1);
+	for (int i = 1; i < threadCount; i++)
+		workers.emplace_back(&WorkerPool::workerLoop, this, i);
+	//the ids are complete once every worker has started
+	std::unique_lock<std::mutex> guard(lock);
+	finished.wait(guard, [this] { return startedWorkers == static_cast<int>(workers.size()); });
+}
+
+inline WorkerPool::~WorkerPool() {
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		stopping = true;
+	}
+	wake.notify_all();
+	for (std::thread& worker : workers)
+		worker.join();
+}
+
+template <typename F>
+void WorkerPool::parallelFor(int count, const F& fn) {
+	if (count <= 0)
+		return;
+	if (workers.empty() || count == 1) {
+		fn(0, count, 0);
+		return;
+	}
+	std::lock_guard<std::mutex> serial(dispatch);
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		job = &fn;
+		invoke = &WorkerPool::invokeChunk<F>;
+		jobCount = count;
+		//a few chunks per thread so uneven chunks even out
+		chunkSize = count / (size() * 4) > 0 ? count / (size() * 4) : 1;
+		nextChunk = 0;
+		running = static_cast<int>(workers.size());
+		generation++;
+	}
+	wake.notify_all();
+	work(0);
+	std::unique_lock<std::mutex> guard(lock);
+	finished.wait(guard, [this] { return running == 0; });
+	job = nullptr;
+}
+
+inline void WorkerPool::work(int thread) {
+	while (true) {
+		int begin = nextChunk.fetch_add(chunkSize);
+		if (begin >= jobCount)
+			return;
+		int end = begin + chunkSize < jobCount ? begin + chunkSize : jobCount;
+		invoke(job, begin, end, thread);
+	}
+}
+
+inline void WorkerPool::workerLoop(int thread) {
+	{
+		std::lock_guard<std::mutex> guard(lock);
+#if defined(__linux__)
+		threadIds[thread - 1] = static_cast<int>(syscall(SYS_gettid));
+#endif
+		startedWorkers++;
+	}
+	finished.notify_one();
+	int seenGeneration = 0;
+	while (true) {
+		{
+			std::unique_lock<std::mutex> guard(lock);
+			wake.wait(guard, [&] { return stopping || generation != seenGeneration; });
+			if (stopping)
+				return;
+			seenGeneration = generation;
+		}
+		work(thread);
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			running--;
+		}
+		finished.notify_one();
+	}
+}
+
+//the pool shared by the whole simulation, started on first use
+inline WorkerPool& workerPool() {
+	static WorkerPool pool(NUMBER_WORKER_THREADS);
+	return pool;
+}
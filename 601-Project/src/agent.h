@@ -4,10 +4,31 @@
 #include "glm/gtx/string_cast.hpp"
 
 #include <vector>
+#include <array>
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <chrono>
+#include <utility>
+#include <type_traits>
+#include <memory_resource>
 #include "settings.h"
 #include "VoxelGrid.h"
 #include "Pheromones.h"
 #include "soil.h"
+#include "SoilTraversal.h"
+#include "DirectionCodebook.h"
+#include "GradientField.h"
+#include "NestDistanceField.h"
+#include "AgentCellList.h"
+#include "SwarmContinuum.h"
+#include "PheromoneSampler.h"
+#include "SoilConsumption.h"
+#include "TaskGraph.h"
+#include "MortonOrder.h"
+#include "StepArena.h"
+#include "WorkerPool.h"
 #include <iostream>
 
 struct Agent {
@@ -16,6 +37,289 @@ struct Agent {
 	glm::vec3 direction = glm::vec3(0, -1, 0);
 	glm::vec3 position = glm::vec3(0);
 	float nutrient = 0;
+	int id = -1; //stays the same for the agent's whole life, slots are reused
+	bool active = false; //false for slots on the free list
+};
+
+//an agent carries at most 5 times the nutrient of the soil voxel it bit
+const float MAX_AGENT_NUTRIENT = 5 * MAX_SOIL_NUTRIENT;
+
+/*
+* The form agents are stored in, 12 bytes instead of the 40 of Agent, so large colonies fit in memory and a step moves less of it
+* The step unpacks an agent into an Agent, works on that and packs it back
+* position: 16 bit fixed point per axis over the pheromone grid (about 1/700 of a voxel)
+* direction: octahedral encoding, 16 bit signed fixed point per component
+* bits: bit 0 the state, bit 1 set if active, the top 14 bits the nutrient as fixed point over [0, MAX_AGENT_NUTRIENT]
+* The id is not part of it, the pool keeps ids in a separate array as only tracing needs them
+*/
+struct PackedAgent {
+	std::uint16_t x = 0, y = 0, z = 0;
+	std::int16_t u = 0, v = 0;
+	std::uint16_t bits = 0;
+
+	static PackedAgent pack(const Agent& agent) {
+		PackedAgent packed;
+		glm::vec3 scale = 65536.f / pheromoneGridDimensions();
+		glm::vec3 position = glm::clamp(agent.position * scale, glm::vec3(0), glm::vec3(65535));
+		packed.x = static_cast<std::uint16_t>(position.x);
+		packed.y = static_cast<std::uint16_t>(position.y);
+		packed.z = static_cast<std::uint16_t>(position.z);
+		glm::vec2 direction = octahedralEncode(agent.direction);
+		packed.u = static_cast<std::int16_t>(std::round(direction.x * 32767));
+		packed.v = static_cast<std::int16_t>(std::round(direction.y * 32767));
+		std::uint16_t nutrient = static_cast<std::uint16_t>(glm::clamp(agent.nutrient / MAX_AGENT_NUTRIENT, 0.f, 1.f) * 16383 + 0.5f);
+		packed.bits = (agent.state == Agent::RETURNING ? 1 : 0) | (agent.active ? 2 : 0) | (nutrient << 2);
+		return packed;
+	}
+
+	//everything but the id
+	Agent unpack() const {
+		Agent agent;
+		agent.state = state();
+		agent.active = isActive();
+		agent.position = position();
+		agent.direction = octahedralDecode(glm::vec2(u, v) / 32767.f);
+		agent.nutrient = (bits >> 2) * (MAX_AGENT_NUTRIENT / 16383);
+		return agent;
+	}
+
+	//positions decode to the middle of their fixed point step, so truncating them to a voxel agrees with the unpacked agent
+	glm::vec3 position() const { return (glm::vec3(x, y, z) + 0.5f) * (pheromoneGridDimensions() / 65536.f); }
+	Agent::State state() const { return (bits & 1) ? Agent::RETURNING : Agent::SEARCHING; }
+	bool isActive() const { return (bits & 2) != 0; }
+	void setActive(bool active) { bits = active ? (bits | 2) : (bits & ~2); }
+};
+static_assert(sizeof(PackedAgent) <= 12, "agents are meant to pack into 12 bytes");
+
+/*
+* Fixed storage for every agent the colony can ever have, so an agent never moves while a phase runs
+* Phases only read and write agents in place (through get and set, which unpack and pack them), anything that changes
+* the population (spawning, despawning, resetting a stuck agent) is queued on the calling thread's queue and applied by commit() once the phase is over
+* The queues are drawn from the step arena, so commit() must run before the step ends
+*/
+class AgentPool {
+public:
+	explicit AgentPool(int _capacity) : slots(_capacity), ids(_capacity, -1) {
+		freeSlots.reserve(_capacity);
+		queues.reserve(workerPool().size());
+		for (int thread = 0; thread < workerPool().size(); thread++)
+			queues.emplace_back(stepArena().resource(thread));
+	}
+	AgentPool(const AgentPool&) = delete;
+	AgentPool& operator=(const AgentPool&) = delete;
+
+	int capacity() const { return static_cast<int>(slots.size()); }
+	//live agents
+	int size() const { return liveCount; }
+	//slots ever used, agents live in [0, slotCount()) and inactive slots in that range are skipped
+	int slotCount() const { return usedSlots.load(std::memory_order_acquire); }
+
+	Agent get(int slot) const {
+		Agent agent = slots[slot].unpack();
+		agent.id = ids[slot];
+		return agent;
+	}
+	void set(int slot, const Agent& agent) {
+		slots[slot] = PackedAgent::pack(agent);
+		ids[slot] = agent.id;
+	}
+	//the parts the neighbour queries need, without unpacking the rest
+	bool isActive(int slot) const { return slots[slot].isActive(); }
+	glm::vec3 position(int slot) const { return slots[slot].position(); }
+	int id(int slot) const { return ids[slot]; }
+
+	//add an agent straight away, only for setting up before the simulation runs. Returns the slot or -1 when the pool is full
+	int spawn(Agent agent) {
+		int slot;
+		if (!freeSlots.empty()) {
+			slot = freeSlots.back();
+			freeSlots.pop_back();
+		}
+		else if (usedSlots.load(std::memory_order_relaxed) < capacity())
+			slot = usedSlots.load(std::memory_order_relaxed);
+		else
+			return -1;
+		agent.id = nextId++;
+		agent.active = true;
+		set(slot, agent);
+		liveCount++;
+		//publish the slot after it is written so the render thread never reads a half built agent
+		if (slot == usedSlots.load(std::memory_order_relaxed))
+			usedSlots.store(slot + 1, std::memory_order_release);
+		return slot;
+	}
+
+	//thread is the worker pool thread the caller runs on (0 outside parallelFor)
+	//spawns are only queued by the serial part of the step, after the graph has run, so they take no thread and their order
+	//never depends on which worker ran a task
+	void queueSpawn(const Agent& agent) { queues[0].spawns.push_back(agent); }
+	void queueDespawn(int slot, int thread = 0) { queues[thread].despawns.push_back(slot); }
+	//put the agent back at the nest as a fresh searcher
+	void queueReset(int slot, int thread = 0) { queues[thread].resets.push_back(slot); }
+
+	//apply the queued changes in thread order, so the result does not depend on how the phase was scheduled
+	//spawns that do not fit are dropped, the colony stops growing at capacity
+	void commit() {
+		for (ThreadQueues& queue : queues) {
+			for (int slot : queue.resets) {
+				Agent agent = get(slot);
+				agent.state = Agent::SEARCHING;
+				agent.position = nestPosition();
+				agent.direction = glm::vec3(0, -1, 0);
+				set(slot, agent);
+			}
+			for (int slot : queue.despawns) {
+				if (!slots[slot].isActive())
+					continue;
+				slots[slot].setActive(false);
+				freeSlots.push_back(slot);
+				liveCount--;
+			}
+		}
+		for (ThreadQueues& queue : queues) {
+			for (const Agent& agent : queue.spawns)
+				spawn(agent);
+			queue.release();
+		}
+	}
+
+	/*
+	* Reorder the live agents by the Morton code of their pheromone voxel, so agents that are close in the grid are close in memory
+	* and the gathers and deposits of consecutive agents hit the same cache lines. Live agents end up packed at the front
+	* Slot numbers change (ids do not), so only call it between steps, with nothing queued
+	* The sort's scratch is only allocated the first time it runs, a colony that is never sorted does not pay for it
+	*/
+	void sortByMorton() {
+		if (sortOrder.empty()) {
+			sortKeys.resize(capacity());
+			sortKeyScratch.resize(capacity());
+			sortOrder.resize(capacity());
+			sortOrderScratch.resize(capacity());
+		}
+		int count = 0;
+		std::uint32_t maxKey = 0;
+		int used = slotCount();
+		for (int slot = 0; slot < used; slot++) {
+			if (!slots[slot].isActive())
+				continue;
+			//the state is the top bit so the sort also leaves the agents partitioned by state
+			sortKeys[count] = mortonCode(glm::ivec3(slots[slot].position())) | (slots[slot].state() == Agent::RETURNING ? 1u << 30 : 0);
+			sortOrder[count] = slot;
+			maxKey |= sortKeys[count];
+			count++;
+		}
+		radixSort(sortKeys.data(), sortOrder.data(), sortKeyScratch.data(), sortOrderScratch.data(), count, maxKey);
+		//the free slots go after the live agents, which makes the order a permutation of every used slot
+		int inactive = count;
+		for (int slot = 0; slot < used; slot++) {
+			if (!slots[slot].isActive())
+				sortOrder[inactive++] = slot;
+		}
+		permute(sortOrder.data(), used);
+		freeSlots.clear();
+		searching = static_cast<int>(std::partition_point(slots.begin(), slots.begin() + count, [](const PackedAgent& agent) { return agent.state() == Agent::SEARCHING; }) - slots.begin());
+		usedSlots.store(count, std::memory_order_release);
+	}
+
+	/*
+	* Pack the live agents with the searching ones first, keeping the order within each state, so each state can run through its own kernel
+	* Agents that changed state last step are moved across, when nothing changed this is just a scan
+	* Slot numbers change (ids do not), so only call it between phases, with nothing queued. The new order is built in the step arena
+	*/
+	void partitionByState() {
+		int used = slotCount();
+		int searchingCount = 0;
+		bool partitioned = freeSlots.empty();
+		for (int slot = 0; slot < used; slot++) {
+			if (slots[slot].state() == Agent::SEARCHING) {
+				partitioned = partitioned && searchingCount == slot;
+				searchingCount++;
+			}
+		}
+		if (partitioned) {
+			searching = searchingCount;
+			return;
+		}
+
+		//searching agents, then returning ones, then the free slots
+		std::pmr::vector<int> order(stepArena().resource());
+		order.reserve(used);
+		int count = 0;
+		for (int pass = 0; pass < 3; pass++) {
+			for (int slot = 0; slot < used; slot++) {
+				bool active = slots[slot].isActive();
+				if (pass == 2 ? !active : active && slots[slot].state() == (pass == 0 ? Agent::SEARCHING : Agent::RETURNING))
+					order.push_back(slot);
+			}
+			if (pass == 0)
+				searching = static_cast<int>(order.size());
+			if (pass == 1)
+				count = static_cast<int>(order.size());
+		}
+		permute(order.data(), used);
+		freeSlots.clear();
+		usedSlots.store(count, std::memory_order_release);
+	}
+
+	//after partitionByState (or sortByMorton) the searching agents are in [0, searchingCount()) and the returning ones in [searchingCount(), slotCount())
+	int searchingCount() const { return searching; }
+
+	//where new and reset agents start
+	static glm::vec3 nestPosition() {
+		return glm::vec3((SOIL_X_LENGTH * 3) / 2, SOIL_Y_LENGTH * 3 - 1, (SOIL_Z_LENGTH * 3) / 2);
+	}
+
+private:
+	//move the agent in slot order[i] to slot i for every i in [0, count), where order is a permutation of [0, count)
+	//each cycle of the permutation is walked once with a single agent held aside, so no second copy of the pool is needed
+	//order is left as the identity
+	void permute(int* order, int count) {
+		for (int start = 0; start < count; start++) {
+			if (order[start] == start)
+				continue;
+			PackedAgent agent = slots[start];
+			int id = ids[start];
+			int slot = start;
+			while (true) {
+				int from = order[slot];
+				order[slot] = slot;
+				if (from == start) {
+					slots[slot] = agent;
+					ids[slot] = id;
+					break;
+				}
+				slots[slot] = slots[from];
+				ids[slot] = ids[from];
+				slot = from;
+			}
+		}
+	}
+
+	struct ThreadQueues {
+		std::pmr::vector<Agent> spawns;
+		std::pmr::vector<int> despawns;
+		std::pmr::vector<int> resets;
+
+		explicit ThreadQueues(std::pmr::memory_resource* arena) : spawns(arena), despawns(arena), resets(arena) {}
+
+		//drop the storage rather than clearing it, it belongs to this step's arena and is reused once the step ends
+		void release() {
+			spawns = std::pmr::vector<Agent>(spawns.get_allocator());
+			despawns = std::pmr::vector<int>(despawns.get_allocator());
+			resets = std::pmr::vector<int>(resets.get_allocator());
+		}
+	};
+
+	std::vector<PackedAgent> slots;
+	std::vector<int> ids; //the id of the agent in each slot, kept apart from the hot agent data
+	std::vector<std::uint32_t> sortKeys, sortKeyScratch;
+	std::vector<int> sortOrder, sortOrderScratch;
+	std::vector<int> freeSlots;
+	std::vector<ThreadQueues> queues;
+	std::atomic<int> usedSlots{ 0 };
+	int liveCount = 0;
+	int nextId = 0;
+	int searching = 0;
 };
 
 struct agentRenderData {
@@ -24,247 +328,608 @@ struct agentRenderData {
 };
 
 float nestNutrients = 0;
+float sensingTime = 0; //ms the last step spent choosing directions
+std::uint64_t agentSteps = 0; //steps taken, agents' random numbers are drawn from it
+
+//random numbers for one agent in one step, the same whatever thread it runs on (splitmix64 over the agent id and the step)
+struct AgentRandom {
+	std::uint64_t state;
+
+	AgentRandom(int id, std::uint64_t step) : state((static_cast<std::uint64_t>(id) << 32) ^ step) {}
+
+	std::uint64_t next() {
+		std::uint64_t z = (state += 0x9e3779b97f4a7c15ull);
+		z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+		z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+		return z ^ (z >> 31);
+	}
+	//uniform in [low, high)
+	float uniform(float low, float high) { return low + (high - low) * ((next() >> 40) * (1.f / 16777216.f)); }
+	//uniform in [0, count)
+	int index(int count) { return static_cast<int>((next() >> 33) % static_cast<std::uint64_t>(count)); }
+};
+
+/*
+* Amortized scheduling: when updating every agent would take longer than the budget, a step only updates the agents whose id
+* falls in this step's share of updateStride, and they move and deposit updateStride times as much so the colony keeps its pace
+* The stride only changes when the phase wraps to 0, once every agent has had its one update of the current cycle, so at the end of
+* every cycle each agent has moved and deposited for exactly the steps that passed. The next stride comes from what an agent cost
+* over the whole cycle rather than from one noisy step
+*/
+float agentStepBudget = 0; //ms for the agent phases, 0 updates every agent every step
+int updateStride = 1;
+int updatePhase = 0;
+float cycleAgentTime = 0; //ms the agent phases took so far this cycle
+int cycleUpdatedAgents = 0;
+int deferredAgents = 0; //live agents the last step skipped
+
+//the sensor layout: one sample straight ahead and a ring of samples on a cone around the agent's direction
+const int numberRadialSamples = 8;
+const float sensorAngle = 3.14/6.f; //radians
+const float sensorDistance = 0.8; //1 = the side length of a soil voxel
+const int sensorCodebookResolution = 64; //the codebook holds resolution^2 directions
+
+//where an agent facing a direction samples, and the frame its random turns are taken in
+struct SensorFrame {
+	glm::vec3 up;
+	glm::vec3 right;
+	std::array<glm::vec3, numberRadialSamples + 1> offsets; //from the agent's position, the front sample first
+};
+
+SensorFrame buildSensorFrame(glm::vec3 front) {
+	SensorFrame frame;
+	glm::vec3 right; //approximate a right vector. This is only used to generate a up vector that is guaranteed perpindicular to front
+	//choose the axis that has the lowest dot with front
+	float fdotx = abs(glm::dot(front, glm::vec3(1, 0, 0)));
+	float fdoty = abs(glm::dot(front, glm::vec3(0, 1, 0)));
+	float fdotz = abs(glm::dot(front, glm::vec3(0, 0, 1)));
+	if (fdotx <= fdoty && fdotx <= fdotz)
+		right = glm::vec3(1, 0, 0);
+	else if (fdoty <= fdotx && fdoty <= fdotz)
+		right = glm::vec3(0, 1, 0);
+	else
+		right = glm::vec3(0, 0, 1);
+
+	frame.up = glm::cross(front, right);
+	frame.right = glm::cross(front, frame.up); //calculate the TRUE right vector
+
+	//sample the front direction
+	frame.offsets[0] = front * sensorDistance;
+	for (int i = 0; i < numberRadialSamples; i++) {
+		const float degreeStep = 6.28 / numberRadialSamples;
+		float theta = degreeStep * i;
+		//trace a circle normal to front
+		glm::vec3 ds = normalize(std::sin(theta) * frame.up + std::cos(theta) * frame.right);
+		glm::vec3 sampleOffset = normalize(std::sin(sensorAngle) * ds + std::cos(sensorAngle) * front);
+
+		//scale the sample offset
+		frame.offsets[i + 1] = sampleOffset * sensorDistance;
+	}
+	return frame;
+}
+
+//sensor frames for a dense set of directions, built once so agents can look theirs up instead of building it every step
+const DirectionCodebook<SensorFrame>& sensorCodebook() {
+	static DirectionCodebook<SensorFrame> codebook(sensorCodebookResolution, buildSensorFrame);
+	return codebook;
+}
+
+//EXACT builds every agent's frame from its direction, CODEBOOK uses the frame of the nearest codebook direction
+enum class SensingMode { EXACT, CODEBOOK };
+SensingMode sensingMode = SensingMode::EXACT;
+
+//returning agents deliver their nutrient once they are inside this box of pheromone voxels around the spawn point
+inline glm::vec3 nestRegionMin() {
+	return glm::vec3(((SOIL_X_LENGTH * 3) / 2) - 4*3, (SOIL_Y_LENGTH * 3) - 2, ((SOIL_Z_LENGTH * 3) / 2) - 4*3);
+}
+inline glm::vec3 nestRegionMax() {
+	return glm::vec3(((SOIL_X_LENGTH * 3) / 2) + 4*3, (SOIL_Y_LENGTH * 3), ((SOIL_Z_LENGTH * 3) / 2) + 4*3);
+}
+
+//PHEROMONE lets returning agents find the nest by the wander pheromone alone, DISTANCE_FIELD also turns them down the nest distance field
+enum class HomingMode { PHEROMONE, DISTANCE_FIELD };
+HomingMode homingMode = HomingMode::PHEROMONE;
+NestDistanceField nestDistance;
+
+//SEPARATE turns agents away from the agents close around them, found through the cell lists
+enum class CrowdingMode { IGNORE, SEPARATE };
+CrowdingMode crowdingMode = CrowdingMode::IGNORE;
+AgentCellList agentCells;
+std::vector<glm::vec3> separation; //per slot, the push away from nearby agents this step
 
-void stepAgents(std::vector<Agent>& agents, VoxelGrid<PheromoneVoxel>& pheromones, VoxelGrid<SoilVoxel>& soil) {
-	const int numberRadialSamples = 8;
-	const float sensorAngle = 3.14/6.f; //radians
-	const float sensorDistance = 0.8; //1 = the side length of a soil voxel
+//the pheromone an agent leaves in a step, made in slot order once every agent has moved. An amount of 0 leaves nothing
+struct AgentDeposit {
+	glm::vec3 position = glm::vec3(0);
+	PheromoneVoxel::Pheromones type = PheromoneVoxel::Wander;
+	float amount = 0;
+};
+std::vector<AgentDeposit> agentDeposits; //per slot
+SoilConsumption soilConsumption;
+
+//SAMPLES steers by the best of the sensor samples, GRADIENT by the shared gradient field of the bricks agents are in
+enum class SteeringMode { SAMPLES, GRADIENT };
+SteeringMode steeringMode = SteeringMode::SAMPLES;
+GradientField steeringField;
+
+//PYRAMID also turns agents up the gradient of a coarse pyramid level, towards trails further away than their sensors reach
+enum class FarSensingMode { OFF, PYRAMID };
+FarSensingMode farSensingMode = FarSensingMode::OFF;
+
+//agents of a big colony that live as densities on the pheromone grid, see SwarmContinuum.h
+SwarmContinuum swarmContinuum;
+const float continuumEdgeDensity = 0.05; //an open voxel with less density than this is outside the field
+//see settings.h, tests lower them so a small colony hands agents over too
+int continuumThreshold = CONTINUUM_THRESHOLD;
+int continuumCellAgents = CONTINUUM_CELL_AGENTS;
+
+/*
+* Add the agent phases to the step's task graph and run it. fieldCommit is the node that writes the next pheromones back into the grid:
+* it waits for everything that reads the pheromones, and nothing that deposits or changes the soil starts before it has run
+*/
+void stepAgents(AgentPool& agents, VoxelGrid<PheromoneVoxel>& pheromones, SoilGrid& soil, TaskGraph& graph, int fieldCommit) {
 	const float turnSpeed = 3.14/4; //how big the turn vector is
 	const float moveSpeed = 0.8;
+	const float collisionMargin = 0.01; //how far short of a soil face a blocked move stops, in pheromone voxels
 	const float randomMovementAngle = 3.14 / 10;
 	const float nutrientWeight = 1;
 	const float foodPheremoneWeight = 1;
 	const float wanderPheremoneWeight = 1;
 
+	const float separationRadius = 1.5; //pheromone voxels
+	const float separationWeight = 0.5;
+	const float farSensingWeight = 0.05; //a light pull, stronger ones hold agents on old trails
+	//the channels (wander, food, root) the far field is weighed by, like the samples but without the soil's nutrient
+	const glm::vec3 searchingChannels(0, foodPheremoneWeight, 5);
+	const glm::vec3 returningChannels(wanderPheremoneWeight, 0, 0);
 	const glm::vec3 influince = glm::vec3(0.00, 0, 0);
+	const DirectionCodebook<SensorFrame>& codebook = sensorCodebook();
+
+	//the distance field is kept up to date in every mode so switching modes never needs a full search
+	if (!nestDistance.isBuilt()) {
+		//the soil voxels whose centres are in the nest region
+		glm::ivec3 nestCellMin = glm::ivec3(glm::ceil((nestRegionMin() - glm::vec3(PHEROMONE_RESOLUTION / 2)) / float(PHEROMONE_RESOLUTION)));
+		glm::ivec3 nestCellMax = glm::ivec3(glm::floor((nestRegionMax() - glm::vec3(PHEROMONE_RESOLUTION / 2)) / float(PHEROMONE_RESOLUTION)));
+		nestDistance.build(soil, nestCellMin, nestCellMax);
+	}
 
-	//update agent
-	for (Agent& agent : agents) {
-		//create the coordinate frame
-		glm::vec3 front = agent.direction;
-
-
-		glm::vec3 right; //approximate a right vector. This is only used to generate a up vector that is guaranteed perpindicular to front
-		//choose the axis that has the lowest dot with front
-		float fdotx = abs(glm::dot(front, glm::vec3(1, 0, 0)));
-		float fdoty = abs(glm::dot(front, glm::vec3(0, 1, 0)));
-		float fdotz = abs(glm::dot(front, glm::vec3(0, 0, 1)));
-		if (fdotx <= fdoty && fdotx <= fdotz)
-			right = glm::vec3(1, 0, 0);
-		else if (fdoty <= fdotx && fdoty <= fdotz)
-			right = glm::vec3(0, 1, 0);
-		else
-			right = glm::vec3(0, 0, 1);
-
-		glm::vec3 up = glm::cross(front, right);
-		right = glm::cross(front, up); //calculate the TRUE right vector
-
-		//std::cout << "\nAgent position: " << glm::to_string(agent.position) << '\n';
-		//std::cout << "Front: " << glm::to_string(front) << " Right: " << glm::to_string(right) << " Up: " << glm::to_string(up) << '\n';
+	//agents that changed state last step are moved to their state's range, so each range runs a kernel built for one state
+	//this moves agents between slots, so it comes before anything kept per slot for the step
+	agents.partitionByState();
+	const int searchingEnd = agents.searchingCount();
+	const int slotEnd = agents.slotCount();
+
+	//the agents this step updates and how much time each of their updates stands for
+	const int stride = updateStride;
+	const int phase = updatePhase;
+	const float stepScale = static_cast<float>(stride);
+	auto scheduled = [&](int slot) { return stride == 1 || agents.id(slot) % stride == phase; };
+	const int liveAgents = agents.size();
+	int updatedAgents = 0;
+
+	//the same weights the samples are scored with, x for searching agents and y for returning ones
+	auto steeringWeights = [&](glm::vec3 pos) {
+		const PheromoneVoxel& voxel = pheromones.peek(pheromones.posToIndex(pos));
+		float nutrient = soil.nutrient(soilCellOf(pos));
+		return glm::vec2(nutrient * nutrientWeight + voxel.pheromones[PheromoneVoxel::Food] * foodPheremoneWeight + voxel.pheromones[PheromoneVoxel::Root] * 5,
+			voxel.pheromones[PheromoneVoxel::Wander] * wanderPheremoneWeight);
+	};
+
+	//build the gradients of what agents look for over the bricks that hold agents, once for all of them
+	if (steeringMode == SteeringMode::GRADIENT) {
+		steeringField.prepare(pheromones);
+		for (int slot = 0; slot < agents.slotCount(); slot++) {
+			if (agents.isActive(slot))
+				steeringField.activate(pheromones.brickOf(pheromones.posToIndex(agents.position(slot))));
+		}
+	}
+	auto computeGradients = [&](int begin, int end, int thread) { steeringField.computeBricks(pheromones, steeringWeights, begin, end); };
 
-		
-		std::vector<glm::vec3> samples;
-		//sample the front direction
-		samples.push_back(front * sensorDistance);
-
-		for (int i = 0; i < numberRadialSamples; i++) {
-			const float degreeStep = 6.28 / numberRadialSamples;
-			float theta = degreeStep * i;
-			//trace a circle normal to front
-			glm::vec3 ds = normalize(sin(theta) * up + cos(theta) * right);
-			glm::vec3 sampleOffset = normalize(sin(sensorAngle) * ds + cos(sensorAngle) * front);
-
-			//scale the sample offset
-			sampleOffset *= sensorDistance;
-			
-			//use the offset to calculate the sample point relative to the agent
-			glm::vec3 samplePos = sampleOffset + agent.position;
-			//std::cout << "Sample position " << glm::to_string(samplePos) << '\n';
-			samples.push_back(samplePos);
-		} //end sampling loop
-
-		std::vector<std::pair<glm::vec3, float>> weights;
-		//calculate the valid samples and their weight
-		for (auto samplePos : samples) {
-			//check that it is in bounds of the grid
-			if (samplePos.x < 0 || samplePos.x > SOIL_X_LENGTH * 3 - 1
-				|| samplePos.y < 0 || samplePos.y > SOIL_Y_LENGTH * 3 - 1
-				|| samplePos.z < 0 || samplePos.z > SOIL_Z_LENGTH * 3 - 1)
+	//the pyramid is brought up to date from the bricks written since the last step, before anyone senses it
+	int pyramidBricks = 0;
+	if (farSensingMode == FarSensingMode::PYRAMID) {
+		pheromonePyramid.prepare(pheromones);
+		pyramidBricks = pheromonePyramid.beginRebuild();
+	}
+	auto rebuildPyramidBricks = [&](int begin, int end, int thread) {
+		pheromonePyramid.rebuildBricks(pheromones, begin, end, [](int brick) { return pheromoneTiles.isCoarseBrick(brick); }, [](glm::vec3 pos) {
+			const PheromoneVoxel& voxel = pheromoneTiles.coarseAt(glm::ivec3(soilCellOf(pos)));
+			return glm::vec3(voxel.pheromones[0], voxel.pheromones[1], voxel.pheromones[2]);
+		});
+	};
+	auto rebuildPyramidTop = [&](int, int, int) { pheromonePyramid.rebuildTop(); };
+
+	//every agent sums the push of its neighbours in parallel, the lists are only read while they do
+	if (crowdingMode == CrowdingMode::SEPARATE) {
+		agentCells.build(agents, glm::ivec3(soil.getDimensions()));
+		if (static_cast<int>(separation.size()) != agents.capacity())
+			separation.assign(agents.capacity(), glm::vec3(0));
+	}
+	auto separate = [&](int begin, int end, int thread) {
+		for (int slot = begin; slot < end; slot++) {
+			if (!agents.isActive(slot) || !scheduled(slot))
+				continue;
+			glm::vec3 position = agents.position(slot);
+			glm::vec3 push(0);
+			agentCells.forEachNear(agents, position, separationRadius, [&](int other) {
+				glm::vec3 offset = position - agents.position(other);
+				float distance2 = glm::dot(offset, offset);
+				//agents on the same spot (just spawned) have no direction to be pushed in
+				if (other != slot && distance2 > 0)
+					push += offset / distance2;
+			});
+			separation[slot] = push;
+		}
+	};
+
+	//update agent. State is std::integral_constant<Agent::State, ...>, every state test below is resolved at compile time
+	//agents draw their random numbers from their id and the step, so the result does not depend on which thread runs them
+	const std::uint64_t step = agentSteps++;
+	auto chooseDirections = [&](auto stateTag, int begin, int end) {
+		using State = decltype(stateTag);
+		for (int slot = begin; slot < end; slot++) {
+			if (!scheduled(slot))
 				continue;
-			glm::vec3 soilLoc = floor(samplePos / 3.f); //the location in the soil grid
+			Agent agent = agents.get(slot);
+			AgentRandom random(agent.id, step);
+			//create the coordinate frame
+			glm::vec3 front = agent.direction;
+			SensorFrame exactFrame;
+			if (sensingMode == SensingMode::EXACT)
+				exactFrame = buildSensorFrame(front);
+			const SensorFrame& frame = sensingMode == SensingMode::EXACT ? exactFrame : codebook.lookup(front);
+			const glm::vec3 up = frame.up;
+			const glm::vec3 right = frame.right;
+
+			//std::cout << "\nAgent position: " << glm::to_string(agent.position) << '\n';
+			//std::cout << "Front: " << glm::to_string(front) << " Right: " << glm::to_string(right) << " Up: " << glm::to_string(up) << '\n';
+
+			//the direction the agent would like to turn towards
+			bool hasPreferred = false;
+			glm::vec3 preferred;
+			if (steeringMode == SteeringMode::GRADIENT) {
+				const SteeringGradient& gradient = steeringField.at(pheromones.posToIndex(agent.position));
+				glm::vec3 g = State::value == Agent::SEARCHING ? gradient.searching : gradient.returning;
+				//the samples only see as far round as the sensor angle, so an agent turns no further from its front than that
+				glm::vec3 across = g - glm::dot(g, front) * front;
+				if (glm::length(g) > 1e-6f && glm::dot(normalize(g), front) >= std::cos(sensorAngle)) {
+					hasPreferred = true;
+					preferred = g;
+				}
+				else if (glm::length(across) > 1e-6f) {
+					hasPreferred = true;
+					preferred = std::cos(sensorAngle) * front + std::sin(sensorAngle) * normalize(across);
+				}
+			}
+			else {
+				std::array<std::pair<glm::vec3, float>, numberRadialSamples + 1> weights;
+				int weightCount = 0;
+				//the sample points inside the grid, their pheromones are blended from the surrounding voxels all at once
+				std::array<glm::vec3, numberRadialSamples + 1> samplePositions;
+				std::array<glm::vec3, numberRadialSamples + 1> samplePheromoneValues;
+				int sampleCount = 0;
+				for (const glm::vec3& offset : frame.offsets) {
+					//use the offset to calculate the sample point relative to the agent
+					glm::vec3 samplePos = agent.position + offset;
+					if (inPheromoneGrid(samplePos))
+						samplePositions[sampleCount++] = samplePos;
+				}
+				samplePheromones(pheromones, samplePositions.data(), sampleCount, samplePheromoneValues.data());
+
+				//calculate the weight of the valid samples
+				for (int sample = 0; sample < sampleCount; sample++) {
+					glm::vec3 samplePos = samplePositions[sample];
+					const glm::vec3& samplePheromone = samplePheromoneValues[sample];
+					glm::vec3 soilLoc = soilCellOf(samplePos); //the location in the soil grid
+
+					//calculate the weight for that location
+					float weight = -1;
+
+					if constexpr (State::value == Agent::SEARCHING) {
+						float nutrient = soil.nutrient(soilLoc);
+						float foodPheromone = samplePheromone[PheromoneVoxel::Food];
+						float rootPheromone = samplePheromone[PheromoneVoxel::Root];
+						weight = nutrient * nutrientWeight + foodPheromone * foodPheremoneWeight + rootPheromone * 5;
+					}
+					else {
+						float pheremone = samplePheromone[PheromoneVoxel::Wander];
+						weight = pheremone * wanderPheremoneWeight;
+					}
 
-			//calculate the weight for that location
-			float weight = -1;
+					//add the weight to the vector after the if statments
+					if (weight == -1)
+						continue;
+					if (weightCount == 0 || weights[0].second == weight)
+						weights[weightCount++] = std::pair<glm::vec3, float>(samplePos, weight);
+					else if (weight > weights[0].second) {
+						weightCount = 0;
+						weights[weightCount++] = std::pair<glm::vec3, float>(samplePos, weight);
+					}
+				}
 
-			if (agent.state == agent.SEARCHING) {
-				float nutrient = soil.at(soilLoc.x, soilLoc.y, soilLoc.z).nutrient;
-				float foodPheromone = pheromones.at(samplePos.x, samplePos.y, samplePos.z).pheromones[PheromoneVoxel::Food];
-				float rootPheromone = pheromones.at(samplePos.x, samplePos.y, samplePos.z).pheromones[PheromoneVoxel::Root];
-				weight = nutrient * nutrientWeight + foodPheromone * foodPheremoneWeight + rootPheromone * 5;
-			}
-			else if (agent.state == agent.RETURNING) {
-				float pheremone = pheromones.at(samplePos.x, samplePos.y, samplePos.z).pheromones[PheromoneVoxel::Wander];
-				weight = pheremone * wanderPheremoneWeight;
+				//choose a random direction from the best ones
+				if (weightCount > 0) {
+					int selection = random.index(weightCount);
+					hasPreferred = true;
+					preferred = weights[selection].first - agent.position;
+				}
 			}
 
-			//add the weight to the vector after the if statments
-			if (weight == -1)
-				continue;
-			if (weights.size() == 0 || weights[0].second == weight)
-				weights.push_back(std::pair<glm::vec3, float>(samplePos, weight));
-			else if (weight > weights[0].second) {
-				weights.clear();
-				weights.push_back(std::pair<glm::vec3, float>(samplePos, weight));
-			}
-		}
+			//add influince
+			agent.direction += influince;
+			agent.direction = normalize(agent.direction);
 
-		//add influince
-		agent.direction += influince;
-		agent.direction = normalize(agent.direction);
+			//head down the distance field, at the nest itself head for the spawn point
+			if (State::value == Agent::RETURNING && homingMode == HomingMode::DISTANCE_FIELD) {
+				glm::ivec3 cell = glm::ivec3(soilCellOf(agent.position));
+				glm::vec3 home = nestDistance.distance(cell) == 0 ? AgentPool::nestPosition() - agent.position : nestDistance.downhill(cell);
+				if (glm::length(home) > 0)
+					agent.direction = normalize(agent.direction + normalize(home) * turnSpeed);
+			}
 
-		//choose a random direction from the best ones
-		if (weights.size() > 0) {
-			int selection = glm::linearRand<int>(0, weights.size() - 1);
-			glm::vec3 a = front;
-			glm::vec3 b = normalize(weights[selection].first);
-			glm::vec3 axis = glm::cross(a, b);
+			if (crowdingMode == CrowdingMode::SEPARATE && glm::length(separation[slot]) > 0)
+				agent.direction = normalize(agent.direction + separation[slot] * separationWeight);
 
-			glm::mat4 R = glm::rotate(glm::mat4(1.0f), turnSpeed, axis);
+			if (farSensingMode == FarSensingMode::PYRAMID) {
+				glm::vec3 far = pheromonePyramid.gradient(FAR_SENSING_LEVEL, agent.position, State::value == Agent::SEARCHING ? searchingChannels : returningChannels);
+				if (glm::length(far) > 1e-6f)
+					agent.direction = normalize(agent.direction + normalize(far) * farSensingWeight);
+			}
 
-			glm::vec3 rotated = glm::vec3(R * glm::vec4(b, 1));
-			/*
-			turnVec *= turnSpeed;
-			agent.direction = normalize(agent.direction + turnVec);
-			agent.direction = normalize(agent.direction);
-			*/
-		}
+			//turn towards what the agent sensed, as far as homing turns it. The samples mode keeps the original behaviour, where the
+			//sampled direction is chosen but the turn towards it is never applied, so only the gradient field steers
+			if (hasPreferred && steeringMode == SteeringMode::GRADIENT)
+				agent.direction = normalize(agent.direction + normalize(preferred) * turnSpeed);
 
 			//std::cout << "CHOOSING RANDOM\n";
 			//calculate a point on a disk defined by up and right
-			float diskAngle = glm::linearRand<float>(0, 6.28);
-			glm::vec3 b = normalize(sin(diskAngle) * up + cos(diskAngle) * right);
+			float diskAngle = random.uniform(0, 6.28);
+			glm::vec3 b = normalize(std::sin(diskAngle) * up + std::cos(diskAngle) * right);
 			glm::vec3 a = front;
 			//compute direction vector
-			float randAngle = glm::linearRand<float>(-randomMovementAngle, randomMovementAngle);
-			glm::vec3 c = cos(randAngle) * a + sin(randAngle) * b;
+			float randAngle = random.uniform(-randomMovementAngle, randomMovementAngle);
+			glm::vec3 c = std::cos(randAngle) * a + std::sin(randAngle) * b;
 			agent.direction += normalize(c);
 			agent.direction = normalize(agent.direction);
+			agents.set(slot, agent);
 		
 
-	}//end direction update loop
-	
-
-
-
-	//update position step
-	for (Agent& agent : agents) {
-		//loop over each agent and move it
-		//if the agent encounters a soil voxel eat some nutrient and make the agent want to follow the return pheromones
-
-		/*
-		* handle collisions
-		* If the choosen direction will result in out of bounds the agent must be bounced immidietly
-		* otherwise the agent will perform the appropiate interaction with the soil
-		*/
-		bool collision = false;
-		int safety = 0;
-		do {
-			safety++;
-			collision = false;
-
-			glm::vec3 nextPos = agent.position + (agent.direction * moveSpeed);
-			glm::vec3 nextSoilPos = floor(nextPos / 3.f);
-			//std::cout << "Next agent position is: " << glm::to_string(nextPos) << '\n';
-			//std::cout << "Next soil position is " << glm::to_string(nextSoilPos) << '\n';
-
+		}//end direction update loop
+	};
+	//a chunk of slots may straddle the end of the searching range
+	auto sense = [&](int begin, int end, int thread) {
+		chooseDirections(std::integral_constant<Agent::State, Agent::SEARCHING>(), begin, std::min(end, searchingEnd));
+		chooseDirections(std::integral_constant<Agent::State, Agent::RETURNING>(), std::max(begin, searchingEnd), end);
+	};
+
+	//detect if the agent is in the nest region
+	auto inNestRegion = [](glm::vec3 position) {
+		glm::vec3 smallValues = nestRegionMin();
+		glm::vec3 largeValues = nestRegionMax();
+		return position.x >= smallValues.x && position.x <= largeValues.x &&
+			position.y >= smallValues.y && position.y <= largeValues.y &&
+			position.z >= smallValues.z && position.z <= largeValues.z;
+	};
+	//a returning agent delivered its nutrient, every 5 make a new agent that joins the colony when the phase is committed
+	//deliveries happen inside graph tasks, so the new agents are only counted here and queued once the graph has run
+	int nestSpawns = 0;
+	auto deliver = [&]() {
+		nestNutrients += 1;
+		if (nestNutrients >= 5 && agents.size() < agents.capacity()) {
+			nestNutrients -= 5;
+			nestSpawns++;
+		}
+	};
+
+	/*
+	* update position step, run in parallel
+	* Agents only read the soil and write their own slot here. Bites are recorded and applied by soilConsumption afterwards,
+	* pheromone deposits go to the agent's slot of agentDeposits and are made in slot order once every agent has moved and the field is committed
+	*/
+	soilConsumption.begin(soil);
+	if (static_cast<int>(agentDeposits.size()) != agents.capacity())
+		agentDeposits.assign(agents.capacity(), AgentDeposit());
+	std::array<int, NUMBER_WORKER_THREADS> threadUpdated{};
+	std::array<int, NUMBER_WORKER_THREADS> threadDelivered{};
+	auto moveAgents = [&](auto stateTag, int begin, int end, int thread) {
+		using State = decltype(stateTag);
+		for (int slot = begin; slot < end; slot++) {
+			agentDeposits[slot].amount = 0;
+			if (!scheduled(slot))
+				continue;
+			threadUpdated[thread]++;
+			Agent agent = agents.get(slot);
+			//loop over each agent and move it
+			//if the agent encounters a soil voxel eat some nutrient and make the agent want to follow the return pheromones
 
-			//check that it is in bounds of the grid
-			if (nextPos.x < 0 || nextPos.x > SOIL_X_LENGTH * 3
-				|| nextPos.y < 0 || nextPos.y > SOIL_Y_LENGTH * 3
-				|| nextPos.z < 0 || nextPos.z > SOIL_Z_LENGTH * 3) {
-				//std::cout << "Out of bounds collision detected\n";
-				collision = true;
+			/*
+			* handle collisions
+			* Walk the soil voxels the move crosses and stop at the first one that is soil (or outside the grid)
+			* The agent moves up to the face it hit and is reflected about that face, otherwise the agent will perform the appropiate interaction with the soil
+			*/
+			glm::vec3 nextPosition = agent.position + agent.direction * moveSpeed * stepScale;
+			bool bit = false;
+			if (soil.isSoil(soilCellOf(agent.position))) {
+				//the agent is inside soil, an impossible situation, so reset it to the beginning once the movement phase is over
+				agents.queueReset(slot, thread);
 			}
-			else if (soil.at(nextSoilPos.x, nextSoilPos.y, nextSoilPos.z).isSoil) {
-				//std::cout << "Soil collision detected\n";
-				collision = true;
-				SoilVoxel& nextSoilVox = soil.at(nextSoilPos.x, nextSoilPos.y, nextSoilPos.z);
-				if (agent.state == agent.SEARCHING) {
-					//if it is going to collide
-					if (nextSoilVox.isSoil) {
-						agent.nutrient = nextSoilVox.nutrient * 5;
-						nextSoilVox.nutrient -= 1;
-						if (nextSoilVox.nutrient <= 0) {
-							nextSoilVox.isSoil = false;
-							nextSoilVox.nutrient = 0;
-							
-							//std::cout << "Soil depleted, removing\n";
-						}
-						agent.state = agent.RETURNING;
+			else {
+				SoilHit hit = traceSoil(soil, agent.position, agent.direction, moveSpeed * stepScale);
+				if (hit.hit) {
+					//stop just short of the face so the agent stays in its open voxel
+					nextPosition = agent.position + agent.direction * std::max(hit.distance - collisionMargin, 0.f);
+					agent.direction = glm::reflect(agent.direction, hit.normal);
+
+					//the bite, the state change and the deposit that follows it are made when the bites are resolved
+					if (State::value == Agent::SEARCHING && hit.inBounds) {
+						soilConsumption.record(SoilBite{ glm::ivec3(hit.cell), agent.id, slot, agent.position }, thread);
+						bit = true;
 					}
 				}
 			}
 
-			//check if a collision occured on this frame and handle the bounce
-			if (collision) {
-				//calculate what vectors need to be flipped to bounce off the collision
-				glm::vec3 currentSoilPos = floor(agent.position / 3.f);
-				glm::vec3 diff = currentSoilPos - nextSoilPos;
-				diff = glm::vec3(abs(diff.x) >= 1 ? -1 : 1, abs(diff.y) >= 1 ? -1 : 1, abs(diff.z) >= 1 ? -1 : 1);
-				agent.direction *= diff;
+			//this is a strict state change, no need to put it in collison handler
+			if constexpr (State::value == Agent::RETURNING) {
+				if (inNestRegion(agent.position)) {
+					agent.state = agent.SEARCHING;
+					threadDelivered[thread]++;
+				}
 			}
-			
-		} while (collision && safety < 5);
-
-		//if the agent was stuck in a impossible situation reset it to the beginning
-		if (safety >= 5) {
-			agent.state = agent.SEARCHING;
-			agent.position = glm::vec3((SOIL_X_LENGTH * 3) / 2, SOIL_Y_LENGTH * 3 - 1, (SOIL_Z_LENGTH * 3) / 2);
-			agent.direction = glm::vec3(0, -1, 0);
-		}
 
+			//deposit pheromones at the current location, selected rather than branched on since agents may have just changed state
+			if (!bit) {
+				bool searching = agent.state == agent.SEARCHING;
+				agentDeposits[slot] = AgentDeposit{ agent.position, searching ? PheromoneVoxel::Wander : PheromoneVoxel::Food, (searching ? 5.f : agent.nutrient) * stepScale };
+			}
 
-		//this is a strict state change, no need to put it in collison handler
-		if (agent.state == agent.RETURNING) {
-			//detect if the agent is in the nest region
-			glm::vec3 smallValues = glm::vec3(((SOIL_X_LENGTH * 3) / 2) - 4*3, (SOIL_Y_LENGTH * 3) - 2, ((SOIL_Z_LENGTH * 3) / 2) - 4*3);
-			glm::vec3 largeValues = glm::vec3(((SOIL_X_LENGTH * 3) / 2) + 4*3, (SOIL_Y_LENGTH * 3), ((SOIL_Z_LENGTH * 3) / 2) + 4*3);
-			if (agent.position.x >= smallValues.x && agent.position.x <= largeValues.x &&
-				agent.position.y >= smallValues.y && agent.position.y <= largeValues.y &&
-				agent.position.z >= smallValues.z && agent.position.z <= largeValues.z) {
+			//move the agent
+			agent.position = nextPosition;
+			agents.set(slot, agent);
+		}
+	};
+	auto move = [&](int begin, int end, int thread) {
+		moveAgents(std::integral_constant<Agent::State, Agent::SEARCHING>(), begin, std::min(end, searchingEnd), thread);
+		moveAgents(std::integral_constant<Agent::State, Agent::RETURNING>(), std::max(begin, searchingEnd), end, thread);
+	};
+
+	//nest deliveries only add up, so their order does not matter
+	auto mergeDeposits = [&](int, int, int) {
+		for (int thread = 0; thread < workerPool().size(); thread++) {
+			updatedAgents += threadUpdated[thread];
+			for (int i = 0; i < threadDelivered[thread]; i++)
+				deliver();
+		}
+		depositPheromones(pheromones, [&](const auto& deposit) {
+			for (int slot = 0; slot < slotEnd; slot++) {
+				const AgentDeposit& agentDeposit = agentDeposits[slot];
+				if (agentDeposit.amount != 0)
+					deposit(agentDeposit.position, agentDeposit.type, agentDeposit.amount);
+			}
+		});
+	};
+
+	//agents that got some nutrient out of their bite turn back, the ones whose voxel was already used up keep searching
+	auto consumeSoil = [&](int, int, int thread) {
+		soilConsumption.resolve(soil, thread, [&](const SoilBite& bite, float soilNutrient) {
+			Agent agent = agents.get(bite.slot);
+			if (soilNutrient >= 0) {
+				agent.nutrient = soilNutrient * 5;
+				agent.state = agent.RETURNING;
+				//searching agents that find soil inside the nest region deliver straight away
+				if (inNestRegion(bite.position)) {
 					agent.state = agent.SEARCHING;
-					nestNutrients += 1;
-					if (nestNutrients >= 5) {
-						nestNutrients -= 5;
-						Agent a = Agent();
-						a.state = a.SEARCHING;
-						a.position = glm::vec3((SOIL_X_LENGTH * 3) / 2, SOIL_Y_LENGTH * 3 - 1, (SOIL_Z_LENGTH * 3) / 2);
-						agents.push_back(a);
-					}
+					deliver();
 				}
-		}
+			}
+			bool searching = agent.state == agent.SEARCHING;
+			depositPheromone(pheromones, bite.position, searching ? PheromoneVoxel::Wander : PheromoneVoxel::Food, (searching ? 5.f : agent.nutrient) * stepScale);
+			agents.set(bite.slot, agent);
+		});
+		for (glm::ivec3 cell : soilConsumption.depleted())
+			nestDistance.opened(soil, cell);
+	};
+
+	/*
+	* gradients, pyramid and separation -> sensing -> movement -> deposits -> soil bites
+	* The field commit waits for the phases that read the pheromones and runs alongside movement, which only reads the soil
+	*/
+	int gradientNode = graph.add("gradient field", steeringMode == SteeringMode::GRADIENT ? steeringField.activeBrickCount() : 0, computeGradients);
+	int pyramidNode = graph.add("pyramid bricks", pyramidBricks, rebuildPyramidBricks);
+	int pyramidTopNode = graph.add("pyramid top", farSensingMode == FarSensingMode::PYRAMID ? 1 : 0, rebuildPyramidTop);
+	int separationNode = graph.add("separation", crowdingMode == CrowdingMode::SEPARATE ? slotEnd : 0, separate);
+	int senseNode = graph.add("sensing", slotEnd, sense);
+	int moveNode = graph.add("movement", slotEnd, move);
+	int depositNode = graph.add("deposits", 1, mergeDeposits);
+	int soilNode = graph.add("soil bites", 1, consumeSoil);
+	graph.precede(gradientNode, senseNode);
+	graph.precede(pyramidNode, pyramidTopNode);
+	graph.precede(pyramidTopNode, senseNode);
+	graph.precede(pyramidTopNode, fieldCommit);
+	graph.precede(separationNode, senseNode);
+	graph.precede(senseNode, moveNode);
+	graph.precede(gradientNode, fieldCommit);
+	graph.precede(senseNode, fieldCommit);
+	graph.precede(moveNode, depositNode);
+	graph.precede(fieldCommit, depositNode);
+	graph.precede(depositNode, soilNode);
+	graph.run();
+	sensingTime = graph.timing(senseNode).span;
+	for (int i = 0; i < nestSpawns; i++) {
+		Agent a = Agent();
+		a.state = a.SEARCHING;
+		a.position = AgentPool::nestPosition();
+		agents.queueSpawn(a);
+	}
 
-		//deposit pheromones at the current location 
-		if (agent.state == agent.SEARCHING)
-			pheromones.at(agent.position.x, agent.position.y, agent.position.z).pheromones[PheromoneVoxel::Wander] += 5;
-		else if (agent.state == agent.RETURNING)
-			pheromones.at(agent.position.x, agent.position.y, agent.position.z).pheromones[PheromoneVoxel::Food] += agent.nutrient;
+	//spread the agents over enough steps that the ones updated each step fit in the budget
+	float agentTime = graph.timing(senseNode).span + graph.timing(moveNode).span;
+	deferredAgents = liveAgents - updatedAgents;
+	cycleAgentTime += agentTime;
+	cycleUpdatedAgents += updatedAgents;
+	updatePhase = (phase + 1) % stride;
+	if (updatePhase == 0) {
+		if (agentStepBudget > 0 && cycleUpdatedAgents > 0) {
+			float perAgent = cycleAgentTime / cycleUpdatedAgents;
+			updateStride = std::clamp(static_cast<int>(std::ceil(perAgent * liveAgents / agentStepBudget)), 1, MAX_UPDATE_STRIDE);
+		}
+		else
+			updateStride = 1;
+		cycleAgentTime = 0;
+		cycleUpdatedAgents = 0;
+	}
 
-		//move the agent
-		agent.position += agent.direction * moveSpeed;
-		
+	//a big colony hands the agents in crowded voxels over to the density field and keeps the rest, which are mostly at its frontier
+	if (agents.size() + swarmContinuum.mass() > continuumThreshold) {
+		swarmContinuum.prepare(pheromoneGridDimensions());
+		agentCells.build(agents, glm::ivec3(soil.getDimensions()));
+		for (int slot = 0; slot < slotEnd; slot++) {
+			glm::vec3 cell = soilCellOf(agents.position(slot));
+			//agents stuck in soil were queued for a reset above
+			if (!agents.isActive(slot) || soil.isSoil(cell) || agentCells.count(glm::ivec3(cell)) < continuumCellAgents)
+				continue;
+			Agent agent = agents.get(slot);
+			swarmContinuum.add(agent.position, agent.state == agent.RETURNING, agent.nutrient);
+			agents.queueDespawn(slot);
+		}
+	}
+	//density at the edge of the field becomes agents again, heading off in a random direction, as long as the pool has room for them
+	int emitted = 0;
+	swarmContinuum.emitFrontier(soil, continuumEdgeDensity, [&](glm::vec3 position, bool isReturning, float nutrient) {
+		if (agents.size() + emitted >= agents.capacity()) {
+			swarmContinuum.add(position, isReturning, nutrient);
+			return;
+		}
+		Agent a = Agent();
+		a.state = isReturning ? a.RETURNING : a.SEARCHING;
+		a.position = position;
+		a.nutrient = nutrient;
+		a.direction = glm::sphericalRand(1.f);
+		agents.queueSpawn(a);
+		emitted++;
+	});
+	agents.commit();
+
+	//the density field moves, eats and deposits like the agents it stands for, and what it delivers grows it at the nest
+	if (swarmContinuum.isActive()) {
+		nestNutrients += swarmContinuum.advance(pheromones, soil, nestDistance, nestRegionMin(), nestRegionMax(), steeringWeights, moveSpeed);
+		if (nestNutrients >= 5) {
+			float spawned = std::floor(nestNutrients / 5);
+			nestNutrients -= spawned * 5;
+			swarmContinuum.spawn(AgentPool::nestPosition(), spawned);
+		}
 	}
 	std::cout << "Positions updated\n";
 }
 
 
-void loadAgentRenderData(const std::vector<Agent>& agents, std::vector<agentRenderData>& instancedAgentData) {
+void loadAgentRenderData(const AgentPool& agents, std::vector<agentRenderData>& instancedAgentData) {
 	instancedAgentData.clear();
-	for (const Agent& agent : agents) {
-		int index = agent.position.x + agent.position.y * SOIL_X_LENGTH * 3 + agent.position.z * SOIL_X_LENGTH * 3 * SOIL_Y_LENGTH * 3;
+	for (int slot = 0; slot < agents.slotCount(); slot++) {
+		if (!agents.isActive(slot))
+			continue;
+		Agent agent = agents.get(slot);
 		glm::vec3 position = glm::vec3(agent.position.x, agent.position.y, agent.position.z);
 		agentRenderData data;
-		data.transform = glm::translate(glm::mat4(1), (position - glm::vec3(1)) / 3.f) * glm::scale(glm::mat4(1), glm::vec3(1 / 3.f));
+		data.transform = pheromoneCellTransform(position);
 		data.color = agent.state == agent.RETURNING ? glm::vec3(0, 0, 1) : glm::vec3(1, 0, 0);
 		instancedAgentData.push_back(data);
 	}
@@ -30,10 +30,16 @@
 
 #include "settings.h"
 #include "agent.h"
-#include "pheromones.h"
+#include "Pheromones.h"
 #include "soil.h"
 #include "clippingPlanes.h"
 #include <thread>
+#include <string>
+#include "argh.h"
+#include "PerfCounters.h"
+#include "AllocationCounter.h"
+#include "StepArena.h"
+#include "Simulation.h"
 
 //camera variables
 bool leftMouseButtonPressed = false;
@@ -121,14 +127,7 @@ void errorCallback(int error, const char* description) {
 
 
 
-void stepSimulation(VoxelGrid<SoilVoxel>& soil, VoxelGrid<PheromoneVoxel>& pheromones, std::vector<Agent>& agents) {
-	pheromoneReactions(pheromones);
-	diffusePheromones(pheromones, soil);
-	evaporatePheromones(pheromones);
-	stepAgents(agents, pheromones, soil);
-}
-
-void simulationThread(VoxelGrid<SoilVoxel>& soil, std::vector<Agent>& agents, VoxelGrid<PheromoneVoxel>& pheromones) {
+void simulationThread(SoilGrid& soil, AgentPool& agents, VoxelGrid<PheromoneVoxel>& pheromones) {
 	//spin up worker threads
 	//create a job pool for the threads to pull from
 
@@ -136,6 +135,8 @@ void simulationThread(VoxelGrid<SoilVoxel>& soil, std::vector<Agent>& agents, Vo
 	using namespace std::chrono;
 
 	double accumulator = 0.0; // The accumulator for the remaining time
+	TlbMissCounter tlbCounter(workerPool().workerThreadIds()); //counts the TLB misses of this thread and the workers while it steps
+	long long stepsTaken = 0;
 
 	auto previous_time = steady_clock::now(); // The time of the previous update
 	double frameTime = 1.f;
@@ -152,7 +153,55 @@ void simulationThread(VoxelGrid<SoilVoxel>& soil, std::vector<Agent>& agents, Vo
 			accumulator += elapsed_time.count();
 			if (accumulator >= panel::stepTime) {
 				accumulator = 0;
+#if CHECK_STEP_ALLOCATIONS
+				long long allocationsBefore = allocationCount();
+				bool continuumWasActive = swarmContinuum.isActive();
+#endif
+				sensingMode = panel::codebookSensing ? SensingMode::CODEBOOK : SensingMode::EXACT;
+				steeringMode = panel::gradientSteering ? SteeringMode::GRADIENT : SteeringMode::SAMPLES;
+				homingMode = panel::distanceHoming ? HomingMode::DISTANCE_FIELD : HomingMode::PHEROMONE;
+				crowdingMode = panel::agentSeparation ? CrowdingMode::SEPARATE : CrowdingMode::IGNORE;
+				agentStepBudget = panel::agentStepBudget;
+				fieldStepping = panel::multiRateField ? FieldStepping::MULTI_RATE : FieldStepping::UNIFORM;
+				fieldResolution = panel::coarseField ? FieldResolution::ADAPTIVE : FieldResolution::FINE;
+				farSensingMode = panel::farSensing ? FarSensingMode::PYRAMID : FarSensingMode::OFF;
+				//every so often put the agents back in grid order, their movement scatters them again over time
+				if (panel::sortAgents && stepsTaken % AGENT_SORT_INTERVAL == 0) {
+					auto sortStart = steady_clock::now();
+					agents.sortByMorton();
+					panel::agentSortTime = duration<float, std::milli>(steady_clock::now() - sortStart).count();
+				}
+				tlbCounter.start();
 				stepSimulation(soil, pheromones, agents);
+				panel::tlbMissesPerStep = tlbCounter.stop();
+				panel::stepArenaPeak = stepArena().peakUsage();
+				panel::stepArenaThreadPeak = stepArena().peakThreadUsage();
+				panel::stepArenaSpill = stepArena().peakSpill();
+				panel::agentSensingTime = sensingTime;
+				panel::continuumAgents = swarmContinuum.mass();
+				panel::deferredAgents = deferredAgents;
+				panel::updateStride = updateStride;
+				panel::fieldBricksAdvanced = static_cast<int>(pheromoneSchedule.due().size());
+				panel::coarseFieldTiles = static_cast<int>(pheromoneTiles.coarseTiles().size());
+				static_assert(TaskGraph::MAX_NODES <= std::tuple_size<decltype(panel::stepTaskTimes)>::value, "the panel must have room for every task");
+				panel::stepTaskCount = stepGraph().timingCount();
+				for (int task = 0; task < panel::stepTaskCount; task++) {
+					const TaskTiming& timing = stepGraph().timing(task);
+					panel::stepTaskTimes[task] = { timing.name, timing.busy, timing.span };
+				}
+				stepsTaken++;
+#if CHECK_STEP_ALLOCATIONS
+				//the first step sizes the scratch buffers, and the step the continuum field starts sizes its fields,
+				//every other step must not touch the heap
+				long long stepAllocations = allocationCount() - allocationsBefore;
+				//an exception would end the program from this thread, so the model is paused instead
+				if (stepsTaken > 1 && continuumWasActive == swarmContinuum.isActive() && stepAllocations != 0) {
+					std::cout << "Simulation step " << stepsTaken << " made " << stepAllocations << " heap allocations, pausing\n";
+					panel::playModel = false;
+				}
+#endif
+				PheromoneBrickSummary totals = summarizePheromones(pheromones);
+				panel::pheromoneTotals = glm::vec3(totals.sum[PheromoneVoxel::Wander], totals.sum[PheromoneVoxel::Food], totals.sum[PheromoneVoxel::Root]);
 				//std::cout << "step\n";
 			}
 		}
@@ -169,7 +218,12 @@ void simulationThread(VoxelGrid<SoilVoxel>& soil, std::vector<Agent>& agents, Vo
 //
 // program entry point
 //
-int main(void) {
+int main(int argc, char** argv) {
+  //--world <file> maps the soil from a world file instead of generating it, the file is created on the first run
+  argh::parser cmdl(argc, argv, argh::parser::PREFER_PARAM_FOR_UNREG_OPTION);
+  std::string worldFile;
+  cmdl("world") >> worldFile;
+
   //set up glfw error handling
   glfwSetErrorCallback(errorCallback);
 
@@ -225,9 +279,13 @@ int main(void) {
 	std::vector<pheremoneRenderData> instancedPheremoneData;
 
 	//simulation state variables
-	std::vector<Agent> agents;
-	VoxelGrid<PheromoneVoxel> pheromones(SOIL_X_LENGTH * 3, SOIL_Y_LENGTH * 3, SOIL_Z_LENGTH * 3);
-	VoxelGrid<SoilVoxel> soil(SOIL_X_LENGTH, SOIL_Y_LENGTH, SOIL_Z_LENGTH);
+	AgentPool agents(AGENT_CAPACITY);
+	GridAllocation pheromoneAllocation;
+	pheromoneAllocation.hugePages = USE_HUGE_PAGES;
+	glm::vec3 pheromoneDimensions = pheromoneGridDimensions();
+	VoxelGrid<PheromoneVoxel> pheromones(pheromoneDimensions.x, pheromoneDimensions.y, pheromoneDimensions.z, pheromoneAllocation);
+	SoilGrid soil = worldFile.empty() ? SoilGrid(SOIL_X_LENGTH, SOIL_Y_LENGTH, SOIL_Z_LENGTH)
+		: SoilGrid(SOIL_X_LENGTH, SOIL_Y_LENGTH, SOIL_Z_LENGTH, worldFile);
 
 	/*
 	* Setup openGL structures for rendering voxel terrain
@@ -365,19 +423,15 @@ int main(void) {
 	glVertexAttribPointer(6, 3, GL_FLOAT, GL_FALSE, 4 * sizeof(glm::vec4) + sizeof(glm::vec3), (void*)(4 * sizeof(glm::vec4)));
 	glVertexAttribDivisor(6, 1);
 
-	generateSoil(soil);
+	if (!soil.isLoadedFromFile())
+		generateSoil(soil);
 
 	loadSoilRenderData(soil, instancedVoxelData, panel::renderSoil == 1);
 	glBindVertexArray(voxels_vertexArray);
 	glBindBuffer(GL_ARRAY_BUFFER, voxels_instanceTransformBuffer);
 	glBufferData(GL_ARRAY_BUFFER, (sizeof(glm::mat4) + sizeof(float))* instancedVoxelData.size(), instancedVoxelData.data(), GL_DYNAMIC_DRAW);
 
-	for (int i = 0; i < NUMBER_OF_STARTING_AGENTS; i++) {
-		Agent a = Agent();
-		a.state = a.SEARCHING;
-		a.position = glm::vec3((SOIL_X_LENGTH * 3) / 2, SOIL_Y_LENGTH * 3 - 1, (SOIL_Z_LENGTH * 3) / 2);
-		agents.push_back(a);
-	}
+	spawnStartingAgents(agents);
 
 	loadAgentRenderData(agents, instancedAgentData);
 
@@ -388,16 +442,16 @@ int main(void) {
 
 
 	//setup panel
-	panel::maxPheromoneClipBounds = glm::vec3(SOIL_X_LENGTH * 3, SOIL_Y_LENGTH * 3, SOIL_Z_LENGTH * 3);
+	panel::maxPheromoneClipBounds = pheromoneDimensions;
 	panel::maxSoilClipBounds = glm::vec3(SOIL_X_LENGTH, SOIL_Y_LENGTH, SOIL_Z_LENGTH);
 
 	panel::soilClipping.xClipMax = SOIL_X_LENGTH;
 	panel::soilClipping.yClipMax = SOIL_Y_LENGTH;
 	panel::soilClipping.zClipMax = SOIL_Z_LENGTH;
 
-	panel::pheromoneClipping.xClipMax = SOIL_X_LENGTH * 3;
-	panel::pheromoneClipping.yClipMax = SOIL_Y_LENGTH * 3;
-	panel::pheromoneClipping.zClipMax = SOIL_Z_LENGTH * 3;
+	panel::pheromoneClipping.xClipMax = pheromoneDimensions.x;
+	panel::pheromoneClipping.yClipMax = pheromoneDimensions.y;
+	panel::pheromoneClipping.zClipMax = pheromoneDimensions.z;
 
 	std::thread SimulationThread(simulationThread, std::ref(soil), std::ref(agents), std::ref(pheromones));
 
@@ -407,6 +461,8 @@ int main(void) {
 	std::chrono::system_clock::time_point start;
 	std::chrono::system_clock::time_point end;
 	std::srand(static_cast<unsigned>(std::time(nullptr)));
+	//the render loop allocates every frame, only the simulation is checked for allocations
+	ignoreAllocationsOnThisThread();
   //
   // main loop
   //
@@ -435,7 +491,7 @@ int main(void) {
 		}
 		if (panel::renderPheremones) {
 			//buffer pheremone data
-			std::vector<PheromoneVoxel::Pheromones> filter;
+			std::pmr::vector<PheromoneVoxel::Pheromones> filter(frameArena().resource());
 			if (panel::renderFood)
 				filter.push_back(PheromoneVoxel::Food);
 			if (panel::renderWander)
@@ -501,6 +557,7 @@ int main(void) {
 
 			glDrawArraysInstanced(GL_TRIANGLES, 0, 36, instancedPheremoneData.size());
 		}
+		frameArena().reset();
 
     panel::updateMenu();
     // Swap buffers and poll events
@@ -21,6 +21,15 @@ float nutrientThreshold = 0;
 
 int renderSoil = 1;
 float stepTime = 0.5;
+float agentStepBudget = 0;
+bool codebookSensing = false;
+bool gradientSteering = false;
+bool distanceHoming = false;
+bool agentSeparation = false;
+bool sortAgents = false;
+bool multiRateField = false;
+bool coarseField = false;
+bool farSensing = false;
 
 
 bool renderGround = true;
@@ -39,6 +48,22 @@ glm::vec3 maxSoilClipBounds = glm::vec3(1);
 clippingPlanes soilClipping;
 bool useSoilClipping = false;
 
+// performance
+long long tlbMissesPerStep = -1;
+glm::vec3 pheromoneTotals = glm::vec3(0);
+size_t stepArenaPeak = 0;
+size_t stepArenaThreadPeak = 0;
+size_t stepArenaSpill = 0;
+float agentSortTime = 0;
+float agentSensingTime = 0;
+float continuumAgents = 0;
+int deferredAgents = 0;
+int updateStride = 1;
+int fieldBricksAdvanced = 0;
+int coarseFieldTiles = 0;
+std::array<StepTaskTime, 32> stepTaskTimes;
+int stepTaskCount = 0;
+
 // reset
 bool resetView = false;
 
@@ -115,6 +140,35 @@ void updateMenu() {
 
 		Spacing();
 		DragFloat("Step time", &stepTime, 0.01, 0, 5);
+		DragFloat("Agent step budget (ms)", &agentStepBudget, 0.1, 0, 100);
+		Checkbox("Codebook agent sensing", &codebookSensing);
+		Checkbox("Gradient field steering", &gradientSteering);
+		Checkbox("Nest distance homing", &distanceHoming);
+		Checkbox("Agent separation", &agentSeparation);
+		Checkbox("Sort agents by Morton order", &sortAgents);
+		Checkbox("Multi-rate pheromone field", &multiRateField);
+		Checkbox("Coarse pheromones away from agents", &coarseField);
+		Checkbox("Far-field pheromone sensing", &farSensing);
+
+		Spacing();
+		if (CollapsingHeader("Performance")) {
+			if (tlbMissesPerStep >= 0)
+				Text("dTLB misses per step: %lld", tlbMissesPerStep);
+			else
+				Text("dTLB misses per step: unavailable");
+			Text("Total pheromone: wander %.1f, food %.1f, root %.1f", pheromoneTotals.x, pheromoneTotals.y, pheromoneTotals.z);
+			Text("Step arena peak: %.1f KB (largest thread %.1f KB)", stepArenaPeak / 1024.0, stepArenaThreadPeak / 1024.0);
+			if (stepArenaSpill > 0)
+				Text("Step arena too small, %.1f KB spilled to the heap", stepArenaSpill / 1024.0);
+			Text("Agent sensing: %.3f ms per step", agentSensingTime);
+			Text("Agent Morton sort: %.3f ms", agentSortTime);
+			Text("Continuum agents: %.0f", continuumAgents);
+			Text("Deferred agents: %d (updating 1 in %d per step)", deferredAgents, updateStride);
+			Text("Pheromone bricks advanced: %d per step", fieldBricksAdvanced);
+			Text("Pheromone tiles at soil resolution: %d", coarseFieldTiles);
+			for (int task = 0; task < stepTaskCount; task++)
+				Text("  %s: %.3f ms busy, %.3f ms span", stepTaskTimes[task].name, stepTaskTimes[task].busy, stepTaskTimes[task].span);
+		}
 
     Spacing();
     Separator();
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <array>
 #include <iosfwd>
 #include <string>
 
@@ -21,6 +22,15 @@ extern float nutrientThreshold;
 
 extern int renderSoil;
 extern float stepTime;
+extern float agentStepBudget; //ms the agent phases of a step may take before agents are updated in turns, 0 for no limit
+extern bool codebookSensing; //use the sensor frame of the nearest codebook direction instead of building every agent's own
+extern bool gradientSteering; //steer by the shared gradient field instead of each agent's own samples
+extern bool distanceHoming; //returning agents follow the distance to the nest
+extern bool agentSeparation; //agents steer away from nearby agents
+extern bool sortAgents; //periodically reorder the agents by Morton code
+extern bool multiRateField; //pheromone bricks far from the agents advance less often
+extern bool coarseField; //regions of the pheromone field the agents have left are simulated at soil resolution
+extern bool farSensing; //agents also steer towards trails beyond their sensors, read from a pyramid of the field
 
 extern bool renderGround;
 extern bool renderAgents;
@@ -38,6 +48,27 @@ extern glm::vec3 maxSoilClipBounds;
 extern clippingPlanes soilClipping;
 extern bool useSoilClipping;
 
+// performance
+extern long long tlbMissesPerStep;
+extern glm::vec3 pheromoneTotals; //wander, food, root
+extern size_t stepArenaPeak; //bytes, largest step
+extern size_t stepArenaThreadPeak; //bytes, largest single thread in a step
+extern size_t stepArenaSpill; //bytes a thread took from the heap because its arena was full
+extern float agentSortTime; //ms, the last Morton sort of the agents
+extern float agentSensingTime; //ms, choosing directions in the last step
+extern float continuumAgents; //agents living as densities in the continuum field
+extern int deferredAgents; //agents the last step left for a later one to stay in budget
+extern int updateStride; //agents are being updated one in this many per step
+extern int fieldBricksAdvanced; //pheromone bricks the last step advanced
+extern int coarseFieldTiles; //tiles of the pheromone field at soil resolution
+struct StepTaskTime {
+	const char* name = "";
+	float busy = 0; //ms, summed over the threads that ran it
+	float span = 0; //ms, first start to last finish
+};
+extern std::array<StepTaskTime, 32> stepTaskTimes; //the tasks of the last step's graph
+extern int stepTaskCount;
+
 // reset
 extern bool resetView;
 
@@ -1,6 +1,20 @@
 //simulation variables
 #define NUMBER_OF_STARTING_AGENTS 10
+#define AGENT_CAPACITY 100000 //the colony stops growing once it reaches this many agents
+#define AGENT_SORT_INTERVAL 50 //steps between reordering the agents by Morton code, when it is turned on
+#define CONTINUUM_THRESHOLD 50000 //above this many agents (discrete plus continuum) agents in crowded soil voxels join the density field
+#define CONTINUUM_CELL_AGENTS 8 //a soil voxel holding this many agents counts as crowded
+#define MAX_UPDATE_STRIDE 8 //over budget, agents are updated at least once every this many steps
+#define MAX_FIELD_INTERVAL 4 //quiet pheromone bricks advance at least once every this many steps, diffusion rate times this must stay at most 1
+#define FIELD_STEEP_SPREAD 1.0f //a pheromone brick whose values differ by more than this advances at least every other step
+#define COARSE_FIELD_DELAY 100 //steps a region of the pheromone field must go without agents nearby before it drops to soil resolution (when enabled)
+#define FAR_SENSING_LEVEL 2 //pyramid level agents sense far ahead with, its cells are 2^level pheromone voxels wide
 #define SOIL_X_LENGTH 30
 #define SOIL_Y_LENGTH 20
 #define SOIL_Z_LENGTH 30
 #define NUMBER_WORKER_THREADS 10 //MUST be at least 1
+#define USE_HUGE_PAGES true //back the pheromone grid with 2MB pages where the OS supports it
+#ifndef CHECK_STEP_ALLOCATIONS
+#define CHECK_STEP_ALLOCATIONS false //count heap allocations made while stepping and stop if a step allocates, the headless tests turn it on
+#endif
+#define STEP_ARENA_BYTES (1 << 20) //scratch memory per thread for one simulation step, see the panel for the peak usage
@@ -3,22 +3,140 @@
 #include <glm/gtc/random.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <vector>
+#include <cstdint>
+#include <string>
+#include <algorithm>
 #include "VoxelGrid.h"
 #include "settings.h"
 #include "clippingPlanes.h"
 
 
-struct SoilVoxel {
-	float nutrient = 0;
-	bool isSoil = true; //if the soil is actually there or if it is now 'root'
+//nutrient is stored as 16 bit fixed point over [0, MAX_SOIL_NUTRIENT]
+const float MAX_SOIL_NUTRIENT = 1.f;
+
+/*
+* The soil is stored as two separate planes so the hot passability checks (collisions, diffusion masking) only touch one bit per voxel
+* occupancy: 1 bit per voxel, set if the soil is actually there or cleared if it is now 'root'
+* nutrients: a quantized 16 bit nutrient value per voxel
+* Both planes use the brick layout of VoxelGrid so a brick of occupancy is a single cache line
+*/
+class SoilGrid {
+public:
+	SoilGrid(int x_length, int y_length, int z_length, GridAllocation allocation = GridAllocation());
+	//map both planes from a world file, the occupancy plane is kept next to it in worldFile + ".occupancy"
+	SoilGrid(int x_length, int y_length, int z_length, const std::string& worldFile);
+
+	bool isSoil(int x, int y, int z);
+	bool isSoil(glm::vec3 pos) { return isSoil(pos.x, pos.y, pos.z); }
+	void setSoil(int x, int y, int z, bool isSoil);
+	void setSoil(glm::vec3 pos, bool _isSoil) { setSoil(pos.x, pos.y, pos.z, _isSoil); }
+	float nutrient(int x, int y, int z);
+	float nutrient(glm::vec3 pos) { return nutrient(pos.x, pos.y, pos.z); }
+	void setNutrient(int x, int y, int z, float nutrient);
+	void setNutrient(glm::vec3 pos, float _nutrient) { setNutrient(pos.x, pos.y, pos.z, _nutrient); }
+
+	//like nutrient(), for drawing the soil. Reads the voxels directly rather than through the grid
+	float displayedNutrient(int x, int y, int z);
+
+	glm::vec3 getDimensions() { return nutrients.getDimensions(); }
+	//true if both planes were read from a complete world file and do not need to be generated
+	bool isLoadedFromFile() { return loaded; }
+	//call once generation has filled a new world, it makes the world file loadable (see GridStorage)
+	void markComplete();
+	//add the bricks around a soil cell to the active region, the bricks agents are working in
+	void markActive(glm::ivec3 cell, int reach) { nutrients.markActive(cell - reach, cell + reach); }
+	//hint to the OS that the active bricks of both planes will be used and the rest may be paged out (mapped worlds only)
+	//the occupancy plane is bricked like the nutrients, so it follows the same bricks at a bit per voxel
+	void adviseResidency() {
+		occupancyStorage.adviseBricks(nutrients.activeBricks(), nutrients.getBrickCount(), VoxelGrid<std::uint16_t>::BRICK_VOLUME / 8);
+		nutrients.adviseResidency();
+	}
+
+private:
+	void initialize();
+	bool inBounds(int x, int y, int z);
+
+	VoxelGrid<std::uint16_t> nutrients;
+	GridStorage occupancyStorage;
+	std::uint64_t* occupancy = nullptr;
+	bool loaded = false;
 };
 
+inline SoilGrid::SoilGrid(int _x_length, int _y_length, int _z_length, GridAllocation allocation)
+	: nutrients(_x_length, _y_length, _z_length, allocation),
+	occupancyStorage(GridStorage::heap(nutrients.getBrickCount() * VoxelGrid<std::uint16_t>::BRICK_VOLUME / 8, allocation)) {
+	initialize();
+}
+
+inline SoilGrid::SoilGrid(int _x_length, int _y_length, int _z_length, const std::string& worldFile)
+	: nutrients(_x_length, _y_length, _z_length, worldFile),
+	occupancyStorage(GridStorage::mapped(worldFile + ".occupancy", WorldFileHeader{ {'S','O','I','L','O','C','C','1'}, 1, VoxelGrid<std::uint16_t>::BRICK_SIZE, _x_length, _y_length, _z_length },
+		nutrients.getBrickCount() * VoxelGrid<std::uint16_t>::BRICK_VOLUME / 8)) {
+	//a world is only complete with both planes, if one was never completed the whole world is generated again
+	loaded = occupancyStorage.loadedFromFile() && nutrients.isLoadedFromFile();
+	initialize();
+}
+
+inline void SoilGrid::initialize() {
+	occupancy = static_cast<std::uint64_t*>(occupancyStorage.data());
+	//every voxel (including brick padding) starts out as soil, matching an unset voxel acting as a wall
+	if (!loaded)
+		std::fill(occupancy, occupancy + occupancyStorage.size() / sizeof(std::uint64_t), ~std::uint64_t(0));
+}
+
+inline bool SoilGrid::inBounds(int x, int y, int z) {
+	glm::vec3 dimensions = nutrients.getDimensions();
+	return x >= 0 && x < dimensions.x && y >= 0 && y < dimensions.y && z >= 0 && z < dimensions.z;
+}
+
+inline bool SoilGrid::isSoil(int x, int y, int z) {
+	//anything outside the grid is solid
+	if (!inBounds(x, y, z))
+		return true;
+	int index = nutrients.posToIndex(glm::vec3(x, y, z));
+	return (occupancy[index >> 6] >> (index & 63)) & 1;
+}
+
+inline void SoilGrid::setSoil(int x, int y, int z, bool _isSoil) {
+	if (!inBounds(x, y, z))
+		throw std::out_of_range("soil position out of bounds");
+	int index = nutrients.posToIndex(glm::vec3(x, y, z));
+	if (_isSoil)
+		occupancy[index >> 6] |= std::uint64_t(1) << (index & 63);
+	else
+		occupancy[index >> 6] &= ~(std::uint64_t(1) << (index & 63));
+}
+
+inline float SoilGrid::displayedNutrient(int x, int y, int z) {
+	if (!inBounds(x, y, z))
+		throw std::out_of_range("soil position out of bounds");
+	return nutrients.voxels()[nutrients.posToIndex(glm::vec3(x, y, z))] * (MAX_SOIL_NUTRIENT / 65535.f);
+}
+
+inline void SoilGrid::markComplete() {
+	nutrients.markComplete();
+	occupancyStorage.markComplete();
+}
+
+inline float SoilGrid::nutrient(int x, int y, int z) {
+	if (!inBounds(x, y, z))
+		throw std::out_of_range("soil position out of bounds");
+	return nutrients.peek(nutrients.posToIndex(glm::vec3(x, y, z))) * (MAX_SOIL_NUTRIENT / 65535.f);
+}
+
+inline void SoilGrid::setNutrient(int x, int y, int z, float _nutrient) {
+	if (!inBounds(x, y, z))
+		throw std::out_of_range("soil position out of bounds");
+	float clamped = glm::clamp(_nutrient, 0.f, MAX_SOIL_NUTRIENT);
+	nutrients.peek(nutrients.posToIndex(glm::vec3(x, y, z))) = static_cast<std::uint16_t>(clamped * (65535.f / MAX_SOIL_NUTRIENT) + 0.5f);
+}
+
 struct soilRenderData {
 	glm::mat4 transform = glm::mat4(1);
 	float nutrient = 0;
 };
 
-void generateSoil(VoxelGrid<SoilVoxel>& soil) {
+void generateSoil(SoilGrid& soil) {
 	const int numberOfSources = 5;
 	//generate the soil with reasonable nutrient distribution
 	//generate n nutrient source points
@@ -38,7 +156,7 @@ void generateSoil(VoxelGrid<SoilVoxel>& soil) {
 						shortestDistance = distance;
 				}
 				//calculate the nutrient value based on a falloff
-				soil.at(x, y, z).nutrient = 50.f / (shortestDistance + 50.f); //(0,1]
+				soil.setNutrient(x, y, z, 50.f / (shortestDistance + 50.f)); //(0,1]
 			}
 		}
 	}
@@ -53,15 +171,17 @@ void generateSoil(VoxelGrid<SoilVoxel>& soil) {
 					|| samplePos.y < 0 || samplePos.y > SOIL_Y_LENGTH - 1
 					|| samplePos.z < 0 || samplePos.z > SOIL_Z_LENGTH - 1)
 					continue;
-				soil.at(samplePos).isSoil = false;
-				soil.at(samplePos).nutrient = 0;
+				soil.setSoil(samplePos, false);
+				soil.setNutrient(samplePos, 0);
 			}
 		}
 	}
+	//a world file is only loaded again once it has been filled
+	soil.markComplete();
 }
 
 
-void loadSoilRenderData(VoxelGrid<SoilVoxel>& soil, std::vector<soilRenderData>& instancedVoxelData, bool isSoilCond = true, clippingPlanes* clip = nullptr) {
+void loadSoilRenderData(SoilGrid& soil, std::vector<soilRenderData>& instancedVoxelData, bool isSoilCond = true, clippingPlanes* clip = nullptr) {
 	glm::vec3 upperBounds;
 	glm::vec3 lowerBounds;
 	if (clip == nullptr) {
@@ -78,20 +198,20 @@ void loadSoilRenderData(VoxelGrid<SoilVoxel>& soil, std::vector<soilRenderData>&
 		for (int x = lowerBounds.x; x < upperBounds.x; x++) {
 			for (int y = lowerBounds.y; y < upperBounds.y; y++) {
 				for (int z = lowerBounds.z; z < upperBounds.z; z++) {
-				if (soil.at(x, y, z).isSoil != isSoilCond) {
+				if (soil.isSoil(x, y, z) != isSoilCond) {
 					continue;
 				}
 				char neighbours = 0;
-				if (x > lowerBounds.x && soil.at(x - 1, y, z).isSoil == isSoilCond) neighbours++;
-				if (x < upperBounds.x - 1 && soil.at(x + 1, y, z).isSoil == isSoilCond) neighbours++;
-				if (y > lowerBounds.y && soil.at(x, y - 1, z).isSoil == isSoilCond) neighbours++;
-				if (y < upperBounds.y - 1 && soil.at(x, y + 1, z).isSoil == isSoilCond) neighbours++;
-				if (z > lowerBounds.z && soil.at(x, y, z - 1).isSoil == isSoilCond) neighbours++;
-				if (z < upperBounds.z - 1 && soil.at(x, y, z + 1).isSoil == isSoilCond) neighbours++;
+				if (x > lowerBounds.x && soil.isSoil(x - 1, y, z) == isSoilCond) neighbours++;
+				if (x < upperBounds.x - 1 && soil.isSoil(x + 1, y, z) == isSoilCond) neighbours++;
+				if (y > lowerBounds.y && soil.isSoil(x, y - 1, z) == isSoilCond) neighbours++;
+				if (y < upperBounds.y - 1 && soil.isSoil(x, y + 1, z) == isSoilCond) neighbours++;
+				if (z > lowerBounds.z && soil.isSoil(x, y, z - 1) == isSoilCond) neighbours++;
+				if (z < upperBounds.z - 1 && soil.isSoil(x, y, z + 1) == isSoilCond) neighbours++;
 				if (neighbours == 6) continue;
 				soilRenderData data;
 				data.transform = glm::translate(glm::mat4(1), glm::vec3(x, y, z));
-				data.nutrient = soil.at(x, y, z).nutrient;
+				data.nutrient = soil.displayedNutrient(x, y, z);
 				instancedVoxelData.push_back(data);
 			}
 		}
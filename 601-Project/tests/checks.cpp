@@ -0,0 +1,861 @@
+/*
+* Checks that parts of the simulation behave as they claim to, each against the straightforward version of what it does
+* checks <name> runs one check and exits with 1 if it fails, ctest runs every check in its own process so the simulation's
+* globals start out fresh for each of them
+*/
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <map>
+#include <random>
+#include <string>
+
+#include "settings.h"
+#include "Simulation.h"
+
+//true if two sums agree to a relative tolerance, for totals of many floats added up in different orders
+bool closeTo(double a, double b, double tolerance = 1e-4) {
+	return std::abs(a - b) <= tolerance * std::max({ std::abs(a), std::abs(b), 1.0 });
+}
+
+//an open world with pheromone deposited all over it, at fixed random positions
+void depositScattered(VoxelGrid<PheromoneVoxel>& pheromones, int count, unsigned seed) {
+	std::mt19937 random(seed);
+	glm::vec3 dimensions = pheromones.getDimensions();
+	std::uniform_real_distribution<float> amount(0.5f, 20.f);
+	for (int i = 0; i < count; i++) {
+		glm::vec3 position(std::uniform_int_distribution<int>(0, dimensions.x - 1)(random), std::uniform_int_distribution<int>(0, dimensions.y - 1)(random),
+			std::uniform_int_distribution<int>(0, dimensions.z - 1)(random));
+		depositPheromone(pheromones, position, static_cast<PheromoneVoxel::Pheromones>(i % PheromoneVoxel::NUMBER_OF_PHEROMONES), amount(random));
+	}
+}
+
+void clearSoil(SoilGrid& soil) {
+	for (int z = 0; z < SOIL_Z_LENGTH; z++)
+		for (int y = 0; y < SOIL_Y_LENGTH; y++)
+			for (int x = 0; x < SOIL_X_LENGTH; x++)
+				soil.setSoil(x, y, z, false);
+}
+
+/*
+* Adaptive field tiles going coarse and fine again. Nothing visits the field, so every tile goes coarse after COARSE_FIELD_DELAY
+* plans, steps a few times at soil resolution, then everything is visited and refined. Each tile must hold the same pheromone on
+* both sides of each handoff, and the brick summaries must add up to what the fine grid holds at the end
+*/
+bool checkCoarseHandoff() {
+	SoilGrid soil(SOIL_X_LENGTH, SOIL_Y_LENGTH, SOIL_Z_LENGTH);
+	clearSoil(soil);
+	glm::vec3 dimensions = pheromoneGridDimensions();
+	VoxelGrid<PheromoneVoxel> pheromones(dimensions.x, dimensions.y, dimensions.z);
+	fieldResolution = FieldResolution::ADAPTIVE;
+	depositScattered(pheromones, 4000, 1);
+
+	pheromoneTiles.prepare(soil, pheromones);
+	int tileCount = 0;
+	glm::ivec3 cellMin, cellMax, brickMin, brickMax;
+	while (true) {
+		pheromoneTiles.ranges(tileCount, cellMin, cellMax, brickMin, brickMax);
+		if (cellMin.z >= SOIL_Z_LENGTH)
+			break;
+		tileCount++;
+	}
+	//the pheromone of every tile, per channel, in the fine voxels and in the coarse ones
+	auto fineSums = [&](int tile) {
+		glm::dvec3 sum(0);
+		pheromoneTiles.ranges(tile, cellMin, cellMax, brickMin, brickMax);
+		for (int z = cellMin.z * PHEROMONE_RESOLUTION; z < cellMax.z * PHEROMONE_RESOLUTION; z++)
+			for (int y = cellMin.y * PHEROMONE_RESOLUTION; y < cellMax.y * PHEROMONE_RESOLUTION; y++)
+				for (int x = cellMin.x * PHEROMONE_RESOLUTION; x < cellMax.x * PHEROMONE_RESOLUTION; x++) {
+					const PheromoneVoxel& voxel = pheromones.voxels()[pheromones.posToIndex(glm::vec3(x, y, z))];
+					sum += glm::dvec3(voxel.pheromones[0], voxel.pheromones[1], voxel.pheromones[2]);
+				}
+		return sum;
+	};
+	auto coarseSums = [&](int tile) {
+		glm::dvec3 sum(0);
+		pheromoneTiles.ranges(tile, cellMin, cellMax, brickMin, brickMax);
+		for (int z = cellMin.z; z < cellMax.z; z++)
+			for (int y = cellMin.y; y < cellMax.y; y++)
+				for (int x = cellMin.x; x < cellMax.x; x++) {
+					const PheromoneVoxel& voxel = pheromoneTiles.coarseAt(glm::ivec3(x, y, z));
+					sum += glm::dvec3(voxel.pheromones[0], voxel.pheromones[1], voxel.pheromones[2]) * double(PHEROMONE_BLOCK_VOLUME);
+				}
+		return sum;
+	};
+	auto sameSums = [](glm::dvec3 a, glm::dvec3 b) { return closeTo(a.x, b.x) && closeTo(a.y, b.y) && closeTo(a.z, b.z); };
+
+	std::vector<glm::dvec3> before(tileCount);
+	for (int tile = 0; tile < tileCount; tile++)
+		before[tile] = fineSums(tile);
+	for (int step = 0; step < COARSE_FIELD_DELAY; step++)
+		planPheromones(pheromones, soil);
+	if (static_cast<int>(pheromoneTiles.coarseTiles().size()) != tileCount) {
+		std::printf("%d of %d tiles went coarse\n", static_cast<int>(pheromoneTiles.coarseTiles().size()), tileCount);
+		return false;
+	}
+	bool passed = true;
+	for (int tile = 0; tile < tileCount; tile++) {
+		if (!sameSums(before[tile], coarseSums(tile))) {
+			std::printf("tile %d going coarse: fine %.4f %.4f %.4f, coarse %.4f %.4f %.4f\n", tile, before[tile].x, before[tile].y, before[tile].z,
+				coarseSums(tile).x, coarseSums(tile).y, coarseSums(tile).z);
+			passed = false;
+		}
+	}
+
+	//the coarse values move away from the pattern the fine voxels kept, which refining has to scale to them
+	for (int step = 0; step < 5; step++) {
+		planPheromones(pheromones, soil);
+		advanceCoarsePheromones(pheromones, soil);
+		commitPheromones(pheromones);
+	}
+	for (int tile = 0; tile < tileCount; tile++)
+		before[tile] = coarseSums(tile);
+	for (int tile = 0; tile < tileCount; tile++) {
+		pheromoneTiles.ranges(tile, cellMin, cellMax, brickMin, brickMax);
+		pheromoneTiles.visit(soilCellCentre(glm::vec3(cellMin)));
+	}
+	planPheromones(pheromones, soil);
+	if (!pheromoneTiles.coarseTiles().empty()) {
+		std::printf("%d tiles stayed coarse after being visited\n", static_cast<int>(pheromoneTiles.coarseTiles().size()));
+		return false;
+	}
+	glm::dvec3 fineTotal(0);
+	for (int tile = 0; tile < tileCount; tile++) {
+		glm::dvec3 after = fineSums(tile);
+		fineTotal += after;
+		if (!sameSums(before[tile], after)) {
+			std::printf("tile %d going fine: coarse %.4f %.4f %.4f, fine %.4f %.4f %.4f\n", tile, before[tile].x, before[tile].y, before[tile].z,
+				after.x, after.y, after.z);
+			passed = false;
+		}
+	}
+	PheromoneBrickSummary summary = summarizePheromones(pheromones);
+	if (!sameSums(fineTotal, glm::dvec3(summary.sum[0], summary.sum[1], summary.sum[2]))) {
+		std::printf("summaries hold %.4f %.4f %.4f, the grid %.4f %.4f %.4f\n", summary.sum[0], summary.sum[1], summary.sum[2], fineTotal.x, fineTotal.y, fineTotal.z);
+		passed = false;
+	}
+	return passed;
+}
+
+/*
+* traceSoil against walls a move could slip past: a wall one voxel thick crossed in a single long move, a diagonal staircase wall
+* whose voxels only meet at edges crossed exactly through an edge, and the walls of the grid. Then random moves through scattered
+* soil against sampling the move finely: the segment up to the hit must be open, the hit voxel must be soil and the hit point on it
+*/
+bool checkTraceSoil() {
+	SoilGrid soil(SOIL_X_LENGTH, SOIL_Y_LENGTH, SOIL_Z_LENGTH);
+	clearSoil(soil);
+	const float R = PHEROMONE_RESOLUTION;
+	bool passed = true;
+	auto expect = [&](const char* name, bool condition) {
+		if (!condition) {
+			std::printf("%s\n", name);
+			passed = false;
+		}
+	};
+
+	//a thin wall at x = 12, the move starts a tenth of a voxel in front of it and would end two voxels past it
+	for (int y = 0; y < SOIL_Y_LENGTH; y++)
+		for (int z = 0; z < SOIL_Z_LENGTH; z++)
+			soil.setSoil(12, y, z, true);
+	SoilHit hit = traceSoil(soil, glm::vec3(11.9f, 5.5f, 5.5f) * R, glm::vec3(1, 0, 0), 2 * R);
+	expect("thin wall: not hit", hit.hit && hit.inBounds);
+	expect("thin wall: wrong voxel", hit.cell == glm::vec3(12, 5, 5));
+	expect("thin wall: wrong normal", hit.normal == glm::vec3(-1, 0, 0));
+	expect("thin wall: wrong distance", std::abs(hit.distance - 0.1f * R) < 1e-4f);
+	//at a grazing angle the move crosses the wall within the same long step
+	glm::vec3 grazing = glm::normalize(glm::vec3(0.2f, 1, 0.3f));
+	hit = traceSoil(soil, glm::vec3(11.95f, 2.5f, 5.5f) * R, grazing, 4 * R);
+	expect("thin wall at a grazing angle: wrong voxel", hit.hit && hit.cell.x == 12);
+	for (int y = 0; y < SOIL_Y_LENGTH; y++)
+		for (int z = 0; z < SOIL_Z_LENGTH; z++)
+			soil.setSoil(12, y, z, false);
+
+	//a staircase wall x + y = 20, a move along (1, 1) from the centre of (9, 10) passes exactly through the edge at (10, 11)
+	//where the open voxels (9, 10) and (10, 11) meet without crossing either wall voxel's face by more than a point
+	for (int x = 1; x < SOIL_X_LENGTH && x <= 20; x++)
+		for (int z = 0; z < SOIL_Z_LENGTH; z++)
+			soil.setSoil(x, 20 - x, z, true);
+	glm::vec3 diagonal = glm::normalize(glm::vec3(1, 1, 0));
+	hit = traceSoil(soil, glm::vec3(9.5f, 10.5f, 5.5f) * R, diagonal, 3 * R);
+	expect("diagonal wall through an edge: not hit", hit.hit && hit.inBounds);
+	expect("diagonal wall through an edge: wrong voxel", hit.cell.x + hit.cell.y == 20);
+	expect("diagonal wall through an edge: wrong distance", std::abs(hit.distance - std::sqrt(0.5f) * R) < 1e-4f);
+	//the same wall crossed off the edges, from a few starting points
+	for (float offset = 0.1f; offset < 1; offset += 0.2f) {
+		hit = traceSoil(soil, glm::vec3(8 + offset, 9.5f, 5.5f) * R, diagonal, 4 * R);
+		expect("diagonal wall: not hit", hit.hit && hit.cell.x + hit.cell.y == 20);
+	}
+	for (int x = 1; x < SOIL_X_LENGTH && x <= 20; x++)
+		for (int z = 0; z < SOIL_Z_LENGTH; z++)
+			soil.setSoil(x, 20 - x, z, false);
+
+	//the grid's walls stop a move too, as a hit outside the grid
+	hit = traceSoil(soil, glm::vec3(0.2f, 5.5f, 5.5f) * R, glm::vec3(-1, 0, 0), R);
+	expect("grid wall: not hit", hit.hit && !hit.inBounds && hit.cell == glm::vec3(-1, 5, 5));
+
+	//random moves through scattered soil. A move that only touches a voxel at an edge or a corner may count as a hit or not,
+	//so the sampled segment is only required to be open up to a little before the hit
+	std::mt19937 random(2);
+	std::uniform_real_distribution<float> unit(0, 1);
+	for (int z = 0; z < SOIL_Z_LENGTH; z++)
+		for (int y = 0; y < SOIL_Y_LENGTH; y++)
+			for (int x = 0; x < SOIL_X_LENGTH; x++)
+				soil.setSoil(x, y, z, unit(random) < 0.15f);
+	const float sampleStep = 1e-3f;
+	int misses = 0, hits = 0;
+	for (int move = 0; move < 2000; move++) {
+		glm::vec3 start = glm::vec3(unit(random) * SOIL_X_LENGTH, unit(random) * SOIL_Y_LENGTH, unit(random) * SOIL_Z_LENGTH) * R;
+		if (soil.isSoil(soilCellOf(start)))
+			continue;
+		glm::vec3 direction = glm::normalize(glm::vec3(unit(random), unit(random), unit(random)) * 2.f - 1.f);
+		float length = unit(random) * 3 * R;
+		hit = traceSoil(soil, start, direction, length);
+		float openUntil = hit.hit ? hit.distance - 2 * sampleStep * R : length;
+		for (float t = 0; t <= openUntil; t += sampleStep * R) {
+			if (soil.isSoil(soilCellOf(start + direction * t))) {
+				misses++;
+				break;
+			}
+		}
+		if (!hit.hit)
+			continue;
+		hits++;
+		glm::vec3 point = (start + direction * hit.distance) / R;
+		bool onVoxel = glm::all(glm::greaterThanEqual(point, hit.cell - 1e-3f)) && glm::all(glm::lessThanEqual(point, hit.cell + 1.f + 1e-3f));
+		expect("random move: hit voxel is not soil", soil.isSoil(hit.cell));
+		expect("random move: hit point is not on the hit voxel", onVoxel);
+		expect("random move: normal does not face the move", glm::dot(hit.normal, direction) < 0);
+		expect("random move: hit further than the move", hit.distance <= length + 1e-4f);
+	}
+	if (misses > 0) {
+		std::printf("%d random moves passed through soil before their hit\n", misses);
+		passed = false;
+	}
+	expect("random moves: too few hits to mean anything", hits > 200);
+	return passed;
+}
+
+/*
+* PackedAgent round trips. Unpacking gives back the state and the active flag exactly, and the position, direction and nutrient to
+* within their fixed point steps. Packing an unpacked agent again gives the same bits, so an agent that is unpacked and packed
+* every step does not drift. Positions that are not within a step of a voxel face stay in their voxel
+*/
+bool checkPackedAgent() {
+	glm::vec3 dimensions = pheromoneGridDimensions();
+	glm::vec3 positionStep = dimensions / 65536.f;
+	const float nutrientStep = MAX_AGENT_NUTRIENT / 16383;
+	std::mt19937 random(3);
+	std::uniform_real_distribution<float> unit(0, 1);
+	std::vector<Agent> agents;
+	for (int i = 0; i < 20000; i++) {
+		Agent agent;
+		agent.state = i % 2 ? Agent::RETURNING : Agent::SEARCHING;
+		agent.active = i % 3 != 0;
+		agent.position = glm::vec3(unit(random), unit(random), unit(random)) * dimensions;
+		agent.direction = glm::normalize(glm::vec3(unit(random), unit(random), unit(random)) * 2.f - 1.f);
+		agent.nutrient = unit(random) * MAX_AGENT_NUTRIENT;
+		agents.push_back(agent);
+	}
+	//the corners of the ranges: the grid's edges, the axes and the diagonals in both halves of the octahedron, no and full nutrient
+	for (glm::vec3 direction : { glm::vec3(1, 0, 0), glm::vec3(-1, 0, 0), glm::vec3(0, 1, 0), glm::vec3(0, -1, 0), glm::vec3(0, 0, 1),
+		glm::vec3(0, 0, -1), glm::vec3(1, 1, 1), glm::vec3(-1, -1, -1), glm::vec3(1, -1, -1), glm::vec3(-1, 1, -1) }) {
+		Agent agent;
+		agent.position = agents.size() % 2 ? glm::vec3(0) : dimensions - positionStep * 0.25f;
+		agent.direction = glm::normalize(direction);
+		agent.nutrient = agents.size() % 2 ? 0 : MAX_AGENT_NUTRIENT;
+		agents.push_back(agent);
+	}
+
+	int failures = 0;
+	float worstAngle = 0;
+	for (const Agent& agent : agents) {
+		PackedAgent packed = PackedAgent::pack(agent);
+		Agent unpacked = packed.unpack();
+		PackedAgent repacked = PackedAgent::pack(unpacked);
+		//the chord between the directions, acos of their dot product is mostly float rounding at angles this small
+		float angle = glm::length(unpacked.direction - agent.direction);
+		worstAngle = std::max(worstAngle, angle);
+		glm::vec3 offset = glm::abs(unpacked.position - agent.position);
+		glm::vec3 fromFace = glm::min(agent.position - glm::floor(agent.position), glm::ceil(agent.position) - agent.position);
+		bool nearFace = glm::any(glm::lessThan(fromFace, positionStep));
+		const char* problem = nullptr;
+		if (unpacked.state != agent.state || unpacked.active != agent.active || packed.isActive() != agent.active || packed.state() != agent.state)
+			problem = "state or active flag changed";
+		else if (glm::any(glm::greaterThan(offset, positionStep)))
+			problem = "position moved by more than a step";
+		else if (!nearFace && glm::floor(unpacked.position) != glm::floor(agent.position))
+			problem = "position changed voxel";
+		else if (std::abs(glm::length(unpacked.direction) - 1) > 1e-5f || angle > 2e-4f)
+			problem = "direction changed";
+		else if (std::abs(unpacked.nutrient - agent.nutrient) > nutrientStep)
+			problem = "nutrient changed by more than a step";
+		else if (repacked.x != packed.x || repacked.y != packed.y || repacked.z != packed.z || repacked.u != packed.u || repacked.v != packed.v || repacked.bits != packed.bits)
+			problem = "packing the unpacked agent changed it";
+		if (problem && failures++ < 10)
+			std::printf("%s: position %.4f %.4f %.4f direction %.4f %.4f %.4f nutrient %.4f\n", problem, agent.position.x, agent.position.y,
+				agent.position.z, agent.direction.x, agent.direction.y, agent.direction.z, agent.nutrient);
+	}
+
+	//nutrient above the maximum is kept at the maximum, toggling the active flag leaves the rest alone
+	Agent full;
+	full.nutrient = 2 * MAX_AGENT_NUTRIENT;
+	full.state = Agent::RETURNING;
+	PackedAgent packed = PackedAgent::pack(full);
+	if (packed.unpack().nutrient != MAX_AGENT_NUTRIENT) {
+		std::printf("nutrient above the maximum unpacks to %.4f\n", packed.unpack().nutrient);
+		failures++;
+	}
+	packed.setActive(true);
+	if (!packed.isActive() || packed.state() != Agent::RETURNING || packed.unpack().nutrient != MAX_AGENT_NUTRIENT) {
+		std::printf("setActive changed more than the active flag\n");
+		failures++;
+	}
+	packed.setActive(false);
+	if (packed.isActive() || packed.bits != PackedAgent::pack(full).bits) {
+		std::printf("setActive(false) did not restore the bits\n");
+		failures++;
+	}
+	std::printf("%d of %d agents changed, worst direction error %.2e\n", failures, static_cast<int>(agents.size()), worstAngle);
+	return failures == 0;
+}
+
+/*
+* Morton codes against interleaving the bits one at a time, and the radix sort against std::stable_sort of the same pairs, for
+* every number of passes and for counts that do not split evenly over the pool's blocks. The keys repeat a lot, so a sort that is
+* not stable puts equal keys' values out of order. Then AgentPool::sortByMorton: every agent is kept, the live ones end up in
+* code order with the searching ones first, and agents with the same code keep the order they had
+*/
+bool checkMortonSort() {
+	std::mt19937 random(4);
+	bool passed = true;
+	for (int i = 0; i < 10000; i++) {
+		glm::ivec3 voxel(random() % 1024, random() % 1024, random() % 1024);
+		std::uint32_t expected = 0;
+		for (int bit = 0; bit < 10; bit++)
+			for (int axis = 0; axis < 3; axis++)
+				expected |= ((voxel[axis] >> bit) & 1u) << (3 * bit + axis);
+		if (mortonCode(voxel) != expected) {
+			std::printf("morton code of %d %d %d is %u, not %u\n", voxel.x, voxel.y, voxel.z, mortonCode(voxel), expected);
+			return false;
+		}
+	}
+
+	for (int count : { 0, 1, 7, 10, 1001, 65537 }) {
+		for (std::uint32_t maxKey : { 0u, 200u, 40000u, 1u << 20, 0xffffffffu }) {
+			//a few distinct keys spread over the whole range, so every pass has digits to sort by and ties are common
+			std::vector<std::uint32_t> distinct(1 + count / 8);
+			for (std::uint32_t& key : distinct)
+				key = maxKey == 0 ? 0 : static_cast<std::uint32_t>(random() % (std::uint64_t(maxKey) + 1));
+			std::vector<std::uint32_t> keys(count), keyScratch(count);
+			std::vector<int> values(count), valueScratch(count);
+			std::vector<std::pair<std::uint32_t, int>> expected(count);
+			std::uint32_t keyBits = 0;
+			for (int i = 0; i < count; i++) {
+				keys[i] = distinct[random() % distinct.size()];
+				values[i] = i;
+				expected[i] = { keys[i], i };
+				keyBits |= keys[i];
+			}
+			std::stable_sort(expected.begin(), expected.end(), [](const auto& a, const auto& b) { return a.first < b.first; });
+			radixSort(keys.data(), values.data(), keyScratch.data(), valueScratch.data(), count, keyBits);
+			for (int i = 0; i < count; i++) {
+				if (keys[i] != expected[i].first || values[i] != expected[i].second) {
+					std::printf("%d keys below %u: entry %d is (%u, %d), stable_sort has (%u, %d)\n", count, maxKey, i, keys[i], values[i],
+						expected[i].first, expected[i].second);
+					passed = false;
+					break;
+				}
+			}
+		}
+	}
+
+	//a pool with free slots in it and agents crowded into a few voxels, in both states
+	AgentPool agents(5000);
+	std::uniform_real_distribution<float> unit(0, 1);
+	for (int i = 0; i < 4000; i++) {
+		Agent agent;
+		agent.state = i % 3 == 0 ? Agent::RETURNING : Agent::SEARCHING;
+		agent.position = glm::vec3(10 + random() % 4, 10 + random() % 4, 10 + random() % 4) + glm::vec3(unit(random), unit(random), unit(random)) * 0.9f;
+		agent.direction = glm::vec3(0, 0, 1);
+		agent.nutrient = unit(random);
+		agent.id = i;
+		agents.spawn(agent);
+	}
+	for (int slot = 0; slot < 4000; slot += 7) {
+		agents.queueDespawn(slot);
+	}
+	agents.commit();
+	auto keyOf = [&](int slot) {
+		return mortonCode(glm::ivec3(agents.position(slot))) | (agents.get(slot).state == Agent::RETURNING ? 1u << 30 : 0);
+	};
+	//what every agent was, and the order of the agents before the sort
+	std::map<int, Agent> before;
+	std::vector<std::pair<std::uint32_t, int>> expected;
+	for (int slot = 0; slot < agents.slotCount(); slot++) {
+		if (!agents.isActive(slot))
+			continue;
+		before[agents.id(slot)] = agents.get(slot);
+		expected.push_back({ keyOf(slot), agents.id(slot) });
+	}
+	std::stable_sort(expected.begin(), expected.end(), [](const auto& a, const auto& b) { return a.first < b.first; });
+	agents.sortByMorton();
+	if (agents.slotCount() != static_cast<int>(before.size()) || agents.size() != static_cast<int>(before.size())) {
+		std::printf("%d agents in %d slots after the sort, %d before\n", agents.size(), agents.slotCount(), static_cast<int>(before.size()));
+		return false;
+	}
+	for (int slot = 0; slot < agents.slotCount(); slot++) {
+		Agent agent = agents.get(slot);
+		auto original = before.find(agent.id);
+		if (!agent.active || original == before.end() || agent.position != original->second.position || agent.state != original->second.state
+			|| agent.nutrient != original->second.nutrient) {
+			std::printf("slot %d holds agent %d, which is not an agent from before the sort\n", slot, agent.id);
+			return false;
+		}
+		if (agent.id != expected[slot].second) {
+			std::printf("slot %d holds agent %d, a stable sort by code puts agent %d there\n", slot, agent.id, expected[slot].second);
+			passed = false;
+			break;
+		}
+	}
+	int searching = 0;
+	while (searching < agents.slotCount() && agents.get(searching).state == Agent::SEARCHING)
+		searching++;
+	if (agents.searchingCount() != searching) {
+		std::printf("the pool counts %d searching agents, the first %d slots are searching\n", agents.searchingCount(), searching);
+		passed = false;
+	}
+	return passed;
+}
+
+/*
+* Restriction and prolongation between the pheromone grid and soil resolution, against summing each block by hand. Averaging a
+* block keeps its pheromone, so does writing a changed coarse value back: the block keeps its pattern scaled to the new value, or
+* takes the value everywhere if it held none of that channel. The maximum restriction and a restriction of part of the grid are
+* checked against the same blocks
+*/
+bool checkRestrictProlong() {
+	glm::vec3 dimensions = pheromoneGridDimensions();
+	VoxelGrid<PheromoneVoxel> pheromones(dimensions.x, dimensions.y, dimensions.z);
+	VoxelGrid<PheromoneVoxel> coarse(SOIL_X_LENGTH, SOIL_Y_LENGTH, SOIL_Z_LENGTH);
+	std::mt19937 random(5);
+	std::uniform_real_distribution<float> unit(0, 1);
+	//some blocks empty, some with one voxel, some full, channels independently
+	for (int z = 0; z < dimensions.z; z++)
+		for (int y = 0; y < dimensions.y; y++)
+			for (int x = 0; x < dimensions.x; x++) {
+				glm::ivec3 cell = glm::ivec3(x, y, z) / PHEROMONE_RESOLUTION;
+				int kind = (cell.x + 2 * cell.y + 3 * cell.z) % 3;
+				PheromoneVoxel& voxel = pheromones.at(x, y, z);
+				for (int i = 0; i < PheromoneVoxel::NUMBER_OF_PHEROMONES; i++) {
+					bool filled = kind == 2 || (kind == 1 && x % PHEROMONE_RESOLUTION == i && y % PHEROMONE_RESOLUTION == 0 && z % PHEROMONE_RESOLUTION == 0);
+					voxel.pheromones[i] = filled ? unit(random) * 10 : 0;
+				}
+			}
+	//the block sums and maxima of every soil voxel, per channel
+	auto blocks = [&](glm::ivec3 cell, bool maximum) {
+		glm::dvec3 result(0);
+		for (int b = 0; b < PHEROMONE_BLOCK_VOLUME; b++) {
+			glm::ivec3 offset(b % PHEROMONE_RESOLUTION, b / PHEROMONE_RESOLUTION % PHEROMONE_RESOLUTION, b / (PHEROMONE_RESOLUTION * PHEROMONE_RESOLUTION));
+			const PheromoneVoxel& voxel = pheromones.voxels()[pheromones.posToIndex(glm::vec3(cell * PHEROMONE_RESOLUTION + offset))];
+			for (int i = 0; i < 3; i++)
+				result[i] = maximum ? std::max(result[i], double(voxel.pheromones[i])) : result[i] + voxel.pheromones[i];
+		}
+		return result;
+	};
+	auto coarseValue = [&](glm::ivec3 cell) {
+		const PheromoneVoxel& voxel = coarse.voxels()[coarse.posToIndex(glm::vec3(cell))];
+		return glm::dvec3(voxel.pheromones[0], voxel.pheromones[1], voxel.pheromones[2]);
+	};
+	auto forEachCell = [&](glm::ivec3 cellMin, glm::ivec3 cellMax, const auto& fn) {
+		for (int z = cellMin.z; z < cellMax.z; z++)
+			for (int y = cellMin.y; y < cellMax.y; y++)
+				for (int x = cellMin.x; x < cellMax.x; x++)
+					fn(glm::ivec3(x, y, z));
+	};
+	glm::ivec3 cells(SOIL_X_LENGTH, SOIL_Y_LENGTH, SOIL_Z_LENGTH);
+	int failures = 0;
+	auto report = [&](const char* what, glm::ivec3 cell, glm::dvec3 expected, glm::dvec3 got) {
+		if (failures++ < 10)
+			std::printf("%s at %d %d %d: expected %.5f %.5f %.5f, got %.5f %.5f %.5f\n", what, cell.x, cell.y, cell.z, expected.x, expected.y,
+				expected.z, got.x, got.y, got.z);
+	};
+	auto same = [](glm::dvec3 a, glm::dvec3 b) { return closeTo(a.x, b.x, 1e-5) && closeTo(a.y, b.y, 1e-5) && closeTo(a.z, b.z, 1e-5); };
+
+	restrictPheromones(pheromones, coarse, RestrictionOp::MAXIMUM);
+	forEachCell(glm::ivec3(0), cells, [&](glm::ivec3 cell) {
+		if (blocks(cell, true) != coarseValue(cell))
+			report("maximum restriction", cell, blocks(cell, true), coarseValue(cell));
+	});
+	//only part of the grid is averaged, the rest keeps the maxima
+	glm::ivec3 partMin(3, 2, 5), partMax(17, 11, 23);
+	restrictPheromones(pheromones, coarse, RestrictionOp::AVERAGE, partMin, partMax);
+	forEachCell(glm::ivec3(0), cells, [&](glm::ivec3 cell) {
+		bool inPart = glm::all(glm::greaterThanEqual(cell, partMin)) && glm::all(glm::lessThan(cell, partMax));
+		if (!inPart && blocks(cell, true) != coarseValue(cell))
+			report("restriction outside its range", cell, blocks(cell, true), coarseValue(cell));
+	});
+	restrictPheromones(pheromones, coarse, RestrictionOp::AVERAGE);
+	double fineTotal = 0, coarseTotal = 0;
+	forEachCell(glm::ivec3(0), cells, [&](glm::ivec3 cell) {
+		glm::dvec3 sum = blocks(cell, false);
+		fineTotal += sum.x + sum.y + sum.z;
+		coarseTotal += (coarseValue(cell).x + coarseValue(cell).y + coarseValue(cell).z) * PHEROMONE_BLOCK_VOLUME;
+		if (!same(sum, coarseValue(cell) * double(PHEROMONE_BLOCK_VOLUME)))
+			report("average restriction", cell, sum, coarseValue(cell) * double(PHEROMONE_BLOCK_VOLUME));
+	});
+	if (!closeTo(fineTotal, coarseTotal, 1e-5))
+		report("average restriction of the whole grid", glm::ivec3(0), glm::dvec3(fineTotal), glm::dvec3(coarseTotal));
+
+	//change the coarse values like a few coarse steps would, some channels to nothing, then write them back
+	std::vector<glm::dvec3> patterns;
+	forEachCell(glm::ivec3(0), cells, [&](glm::ivec3 cell) {
+		PheromoneVoxel& voxel = coarse.peek(coarse.posToIndex(glm::vec3(cell)));
+		for (int i = 0; i < PheromoneVoxel::NUMBER_OF_PHEROMONES; i++)
+			voxel.pheromones[i] = unit(random) < 0.1f ? 0 : voxel.pheromones[i] * (0.5f + unit(random)) + (unit(random) < 0.2f ? unit(random) : 0);
+	});
+	std::vector<PheromoneVoxel> original(pheromones.voxels(), pheromones.voxels() + pheromones.getBrickCount() * VoxelGrid<PheromoneVoxel>::BRICK_VOLUME);
+	prolongPheromones(coarse, pheromones, glm::ivec3(0), cells);
+	forEachCell(glm::ivec3(0), cells, [&](glm::ivec3 cell) {
+		glm::dvec3 expected = coarseValue(cell) * double(PHEROMONE_BLOCK_VOLUME);
+		if (!same(blocks(cell, false), expected))
+			report("prolongation", cell, expected, blocks(cell, false));
+		//each voxel is its old value times the block's scale, or the coarse value if the block held none of the channel
+		for (int b = 0; b < PHEROMONE_BLOCK_VOLUME; b++) {
+			glm::ivec3 offset(b % PHEROMONE_RESOLUTION, b / PHEROMONE_RESOLUTION % PHEROMONE_RESOLUTION, b / (PHEROMONE_RESOLUTION * PHEROMONE_RESOLUTION));
+			int e = pheromones.posToIndex(glm::vec3(cell * PHEROMONE_RESOLUTION + offset));
+			glm::dvec3 got(pheromones.voxels()[e].pheromones[0], pheromones.voxels()[e].pheromones[1], pheromones.voxels()[e].pheromones[2]);
+			glm::dvec3 want;
+			for (int i = 0; i < 3; i++) {
+				double oldSum = 0;
+				for (int c = 0; c < PHEROMONE_BLOCK_VOLUME; c++) {
+					glm::ivec3 o(c % PHEROMONE_RESOLUTION, c / PHEROMONE_RESOLUTION % PHEROMONE_RESOLUTION, c / (PHEROMONE_RESOLUTION * PHEROMONE_RESOLUTION));
+					oldSum += original[pheromones.posToIndex(glm::vec3(cell * PHEROMONE_RESOLUTION + o))].pheromones[i];
+				}
+				want[i] = oldSum > 0 ? original[e].pheromones[i] * expected[i] / oldSum : coarseValue(cell)[i];
+			}
+			if (!same(got, want)) {
+				report("prolongation pattern", cell, want, got);
+				break;
+			}
+		}
+	});
+	std::printf("%.3f in the fine grid, %.3f restricted\n", fineTotal, coarseTotal);
+	return failures == 0;
+}
+
+/*
+* The batched trilinear sampler (eight positions at a time with AVX2) against the one position path and against blending the eight
+* surrounding voxels by hand, in double precision through posToIndex. The positions cover the whole grid including its edges,
+* where the corners are clamped, and batches whose size is not a multiple of eight
+*/
+bool checkTrilinearSampler() {
+	glm::vec3 dimensions = pheromoneGridDimensions();
+	VoxelGrid<PheromoneVoxel> pheromones(dimensions.x, dimensions.y, dimensions.z);
+	std::mt19937 random(6);
+	std::uniform_real_distribution<float> unit(0, 1);
+	for (int z = 0; z < dimensions.z; z++)
+		for (int y = 0; y < dimensions.y; y++)
+			for (int x = 0; x < dimensions.x; x++) {
+				PheromoneVoxel& voxel = pheromones.at(x, y, z);
+				for (int i = 0; i < PheromoneVoxel::NUMBER_OF_PHEROMONES; i++)
+					voxel.pheromones[i] = unit(random) < 0.3f ? unit(random) * 100 : 0;
+			}
+	std::vector<glm::vec3> positions;
+	for (int i = 0; i < 20000; i++)
+		positions.push_back(glm::vec3(unit(random), unit(random), unit(random)) * dimensions);
+	//the faces, edges and corners of the grid, and voxel centres, where a blend weight is exactly 0 or 1
+	for (float x : { 0.f, 0.5f, 1.f, dimensions.x - 1, dimensions.x - 0.5f, dimensions.x - 1e-3f })
+		for (float y : { 0.f, 0.25f, dimensions.y - 0.5f, dimensions.y - 1e-3f })
+			for (float z : { 0.f, 7.5f, 8.f, dimensions.z - 0.5f, dimensions.z - 1e-3f })
+				positions.push_back(glm::vec3(x, y, z));
+
+	auto reference = [&](glm::vec3 position) {
+		glm::dvec3 q = glm::dvec3(position) - 0.5;
+		glm::dvec3 floored = glm::floor(q);
+		glm::dvec3 t = q - floored;
+		glm::dvec3 value(0);
+		for (int c = 0; c < 8; c++) {
+			glm::ivec3 corner = glm::clamp(glm::ivec3(floored) + glm::ivec3(c & 1, (c >> 1) & 1, c >> 2), glm::ivec3(0), glm::ivec3(dimensions) - 1);
+			double weight = (c & 1 ? t.x : 1 - t.x) * ((c >> 1) & 1 ? t.y : 1 - t.y) * (c >> 2 ? t.z : 1 - t.z);
+			const PheromoneVoxel& voxel = pheromones.voxels()[pheromones.posToIndex(glm::vec3(corner))];
+			value += weight * glm::dvec3(voxel.pheromones[0], voxel.pheromones[1], voxel.pheromones[2]);
+		}
+		return value;
+	};
+	auto same = [](glm::dvec3 a, glm::dvec3 b) { return closeTo(a.x, b.x, 1e-5) && closeTo(a.y, b.y, 1e-5) && closeTo(a.z, b.z, 1e-5); };
+
+	int failures = 0;
+	BrickIndexTerms terms(pheromones);
+	glm::ivec3 last = glm::ivec3(dimensions) - 1;
+	for (int count : { 1, 7, 8, 13, 64, static_cast<int>(positions.size()) }) {
+		std::vector<glm::vec3> values(count);
+		samplePheromones(pheromones, positions.data() + positions.size() - count, count, values.data());
+		for (int i = 0; i < count; i++) {
+			glm::vec3 position = positions[positions.size() - count + i];
+			glm::vec3 single = samplePheromones(pheromones.voxels(), terms, last, position);
+			glm::dvec3 expected = reference(position);
+			if ((!same(glm::dvec3(values[i]), glm::dvec3(single)) || !same(glm::dvec3(values[i]), expected)) && failures++ < 10)
+				std::printf("batch of %d at %.4f %.4f %.4f: batch %.5f %.5f %.5f, single %.5f %.5f %.5f, by hand %.5f %.5f %.5f\n", count,
+					position.x, position.y, position.z, values[i].x, values[i].y, values[i].z, single.x, single.y, single.z, expected.x, expected.y, expected.z);
+		}
+	}
+#if defined(__AVX2__)
+	std::printf("sampled with AVX2\n");
+#else
+	std::printf("sampled without AVX2, configure with ENABLE_AVX2 to check the gathers\n");
+#endif
+	return failures == 0;
+}
+
+/*
+* NestDistanceField kept up to date while soil is dug away, against searching the whole grid again. The soil starts dense enough
+* that most open voxels are cut off from the nest, then is removed a voxel at a time in random order, so removals join pockets to
+* the nest, shorten paths that were already there, and do nothing at all. Every distance must match a fresh build after each batch
+*/
+bool checkNestDistance() {
+	SoilGrid soil(SOIL_X_LENGTH, SOIL_Y_LENGTH, SOIL_Z_LENGTH);
+	std::mt19937 random(7);
+	std::uniform_real_distribution<float> unit(0, 1);
+	glm::ivec3 nestMin(4, 4, 4), nestMax(7, 7, 7);
+	std::vector<glm::ivec3> soilCells;
+	for (int z = 0; z < SOIL_Z_LENGTH; z++)
+		for (int y = 0; y < SOIL_Y_LENGTH; y++)
+			for (int x = 0; x < SOIL_X_LENGTH; x++) {
+				glm::ivec3 cell(x, y, z);
+				bool inNest = glm::all(glm::greaterThanEqual(cell, nestMin)) && glm::all(glm::lessThanEqual(cell, nestMax));
+				bool isSoil = !inNest && unit(random) < 0.6f;
+				soil.setSoil(x, y, z, isSoil);
+				if (isSoil)
+					soilCells.push_back(cell);
+			}
+	std::shuffle(soilCells.begin(), soilCells.end(), random);
+
+	NestDistanceField incremental, rebuilt;
+	incremental.build(soil, nestMin, nestMax);
+	int failures = 0;
+	int reachableAtStart = -1, reachable = 0;
+	const int batch = static_cast<int>(soilCells.size()) / 40;
+	for (size_t removed = 0; removed <= soilCells.size(); removed += batch) {
+		rebuilt.build(soil, nestMin, nestMax);
+		reachable = 0;
+		for (int z = 0; z < SOIL_Z_LENGTH; z++)
+			for (int y = 0; y < SOIL_Y_LENGTH; y++)
+				for (int x = 0; x < SOIL_X_LENGTH; x++) {
+					glm::ivec3 cell(x, y, z);
+					int expected = rebuilt.distance(cell);
+					reachable += expected != NestDistanceField::UNREACHABLE;
+					if (incremental.distance(cell) != expected && failures++ < 10)
+						std::printf("%d voxels removed: %d %d %d is %d from the nest, a rebuild says %d\n", static_cast<int>(removed), x, y, z,
+							incremental.distance(cell), expected);
+				}
+		if (reachableAtStart < 0)
+			reachableAtStart = reachable;
+		for (size_t i = removed; i < std::min(removed + batch, soilCells.size()); i++) {
+			glm::ivec3 cell = soilCells[i];
+			soil.setSoil(cell.x, cell.y, cell.z, false);
+			incremental.opened(soil, cell);
+		}
+	}
+	std::printf("%d voxels reached the nest at the start, %d at the end\n", reachableAtStart, reachable);
+	if (reachableAtStart * 2 > reachable) {
+		std::printf("too little of the grid was joined to the nest to mean anything\n");
+		failures++;
+	}
+	return failures == 0;
+}
+
+/*
+* SoilConsumption against applying the same bites by hand in voxel then agent id order. The bites are recorded on different
+* threads in a different order each time and merged on a different thread, every time the same agents must get the nutrient,
+* in the same order, and leave the soil and the depletion events the same. Most voxels are bitten by several agents at once
+*/
+bool checkSoilConsumption() {
+	SoilGrid soil(SOIL_X_LENGTH, SOIL_Y_LENGTH, SOIL_Z_LENGTH), expectedSoil(SOIL_X_LENGTH, SOIL_Y_LENGTH, SOIL_Z_LENGTH);
+	std::mt19937 random(8);
+	std::uniform_real_distribution<float> unit(0, 1);
+	//a few voxels, some of them open, each bitten by agents with scattered ids
+	std::vector<glm::ivec3> cells;
+	for (int i = 0; i < 40; i++)
+		cells.push_back(glm::ivec3(random() % SOIL_X_LENGTH, random() % SOIL_Y_LENGTH, random() % SOIL_Z_LENGTH));
+	std::vector<SoilBite> bites;
+	std::vector<int> ids(600);
+	for (int i = 0; i < static_cast<int>(ids.size()); i++)
+		ids[i] = i * 7;
+	std::shuffle(ids.begin(), ids.end(), random);
+	for (int i = 0; i < static_cast<int>(ids.size()); i++)
+		bites.push_back(SoilBite{ cells[random() % cells.size()], ids[i], i, glm::vec3(0) });
+	std::vector<float> startNutrient(cells.size());
+	for (float& nutrient : startNutrient)
+		nutrient = 0.05f + unit(random) * MAX_SOIL_NUTRIENT;
+	auto fill = [&](SoilGrid& grid) {
+		clearSoil(grid);
+		for (size_t i = 0; i < cells.size(); i++) {
+			grid.setSoil(cells[i].x, cells[i].y, cells[i].z, i % 5 != 0);
+			grid.setNutrient(cells[i].x, cells[i].y, cells[i].z, startNutrient[i]);
+		}
+	};
+
+	//by hand: one bite after another in voxel then agent id order
+	struct Bitten {
+		int agentId;
+		int slot;
+		float nutrient;
+		bool operator!=(const Bitten& other) const { return agentId != other.agentId || slot != other.slot || nutrient != other.nutrient; }
+	};
+	std::vector<Bitten> expected;
+	std::vector<glm::ivec3> expectedDepleted;
+	fill(expectedSoil);
+	std::vector<SoilBite> ordered = bites;
+	auto cellIndex = [](glm::ivec3 cell) { return cell.x + SOIL_X_LENGTH * (cell.y + SOIL_Y_LENGTH * cell.z); };
+	std::sort(ordered.begin(), ordered.end(), [&](const SoilBite& a, const SoilBite& b) {
+		return cellIndex(a.cell) != cellIndex(b.cell) ? cellIndex(a.cell) < cellIndex(b.cell) : a.agentId < b.agentId;
+	});
+	for (const SoilBite& bite : ordered) {
+		if (!expectedSoil.isSoil(glm::vec3(bite.cell))) {
+			expected.push_back({ bite.agentId, bite.slot, -1.f });
+			continue;
+		}
+		float nutrient = expectedSoil.nutrient(glm::vec3(bite.cell));
+		expected.push_back({ bite.agentId, bite.slot, nutrient });
+		if (nutrient - 1 <= 0) {
+			expectedSoil.setSoil(glm::vec3(bite.cell), false);
+			expectedDepleted.push_back(bite.cell);
+		}
+		expectedSoil.setNutrient(glm::vec3(bite.cell), std::max(nutrient - 1, 0.f));
+	}
+
+	int failures = 0;
+	const int threads = workerPool().size();
+	SoilConsumption consumption;
+	for (int trial = 0; trial < 6; trial++) {
+		fill(soil);
+		std::shuffle(bites.begin(), bites.end(), random);
+		consumption.begin(soil);
+		//the first trial records everything on one thread, the rest spread the bites over all of them
+		for (const SoilBite& bite : bites)
+			consumption.record(bite, trial == 0 ? 0 : static_cast<int>(random() % threads));
+		std::vector<Bitten> got;
+		consumption.resolve(soil, trial % threads, [&](const SoilBite& bite, float nutrient) { got.push_back({ bite.agentId, bite.slot, nutrient }); });
+		stepArena().reset();
+
+		for (size_t i = 0; i < std::max(got.size(), expected.size()); i++) {
+			if (i >= got.size() || i >= expected.size() || got[i] != expected[i]) {
+				if (failures++ < 10)
+					std::printf("trial %d: bite %d went to agent %d with %.4f, by hand to agent %d with %.4f\n", trial, static_cast<int>(i),
+						i < got.size() ? got[i].agentId : -1, i < got.size() ? got[i].nutrient : 0, i < expected.size() ? expected[i].agentId : -1,
+						i < expected.size() ? expected[i].nutrient : 0);
+				break;
+			}
+		}
+		if (consumption.depleted() != expectedDepleted && failures++ < 10)
+			std::printf("trial %d: %d voxels depleted, by hand %d\n", trial, static_cast<int>(consumption.depleted().size()),
+				static_cast<int>(expectedDepleted.size()));
+		for (glm::ivec3 cell : cells) {
+			if ((soil.isSoil(glm::vec3(cell)) != expectedSoil.isSoil(glm::vec3(cell)) || soil.nutrient(glm::vec3(cell)) != expectedSoil.nutrient(glm::vec3(cell)))
+				&& failures++ < 10)
+				std::printf("trial %d: voxel %d %d %d left with %.4f, by hand %.4f\n", trial, cell.x, cell.y, cell.z, soil.nutrient(glm::vec3(cell)),
+					expectedSoil.nutrient(glm::vec3(cell)));
+		}
+	}
+	int taken = 0;
+	for (const Bitten& bite : expected)
+		taken += bite.nutrient >= 0;
+	std::printf("%d bites, %d of them took nutrient, %d voxels depleted\n", static_cast<int>(expected.size()), taken, static_cast<int>(expectedDepleted.size()));
+	return failures == 0;
+}
+
+/*
+* PheromonePyramid levels against averaging the voxels each cell covers by hand, for every level. The grid does not halve evenly,
+* so the cells at its far edges cover fewer voxels than the rest. Then a few voxels change and only their bricks are rebuilt,
+* the levels above them must be brought up to date as well
+*/
+bool checkPyramid() {
+	glm::vec3 dimensions = pheromoneGridDimensions();
+	VoxelGrid<PheromoneVoxel> pheromones(dimensions.x, dimensions.y, dimensions.z);
+	std::mt19937 random(9);
+	std::uniform_real_distribution<float> unit(0, 1);
+	for (int z = 0; z < dimensions.z; z++)
+		for (int y = 0; y < dimensions.y; y++)
+			for (int x = 0; x < dimensions.x; x++) {
+				PheromoneVoxel& voxel = pheromones.at(x, y, z);
+				for (int i = 0; i < PheromoneVoxel::NUMBER_OF_PHEROMONES; i++)
+					voxel.pheromones[i] = unit(random) < 0.3f ? unit(random) * 100 : 0;
+			}
+	PheromonePyramid<PheromoneVoxel> pyramid;
+	auto rebuild = [&]() {
+		int bricks = pyramid.beginRebuild();
+		pyramid.rebuildBricks(pheromones, 0, bricks, [](int) { return false; }, [](glm::vec3) { return glm::vec3(0); });
+		pyramid.rebuildTop();
+		return bricks;
+	};
+	//every cell of every level against the average of the grid voxels inside it
+	int failures = 0;
+	auto compare = [&](const char* when) {
+		for (int level = 1; level <= pyramid.levelCount(); level++) {
+			const int width = 1 << level;
+			glm::ivec3 size = (glm::ivec3(dimensions) + width - 1) / width;
+			for (int z = 0; z < size.z; z++)
+				for (int y = 0; y < size.y; y++)
+					for (int x = 0; x < size.x; x++) {
+						glm::ivec3 low = glm::ivec3(x, y, z) * width;
+						glm::ivec3 high = glm::min(low + width, glm::ivec3(dimensions));
+						glm::dvec3 sum(0);
+						for (int vz = low.z; vz < high.z; vz++)
+							for (int vy = low.y; vy < high.y; vy++)
+								for (int vx = low.x; vx < high.x; vx++) {
+									const PheromoneVoxel& voxel = pheromones.voxels()[pheromones.posToIndex(glm::vec3(vx, vy, vz))];
+									sum += glm::dvec3(voxel.pheromones[0], voxel.pheromones[1], voxel.pheromones[2]);
+								}
+						glm::ivec3 extent = high - low;
+						glm::dvec3 expected = sum / double(extent.x * extent.y * extent.z);
+						glm::vec3 got = pyramid.at(level, glm::vec3(low) + 0.5f);
+						if ((!closeTo(got.x, expected.x, 1e-5) || !closeTo(got.y, expected.y, 1e-5) || !closeTo(got.z, expected.z, 1e-5)) && failures++ < 10)
+							std::printf("%s: level %d cell %d %d %d holds %.5f %.5f %.5f, its voxels average %.5f %.5f %.5f\n", when, level, x, y, z,
+								got.x, got.y, got.z, expected.x, expected.y, expected.z);
+					}
+		}
+	};
+
+	pyramid.prepare(pheromones);
+	rebuild();
+	compare("first rebuild");
+	//a handful of voxels, some of them in the last bricks along each axis
+	for (int i = 0; i < 12; i++) {
+		glm::vec3 position = i % 3 == 0 ? dimensions - 1.f - glm::vec3(random() % 3, random() % 3, random() % 3)
+			: glm::vec3(random() % int(dimensions.x), random() % int(dimensions.y), random() % int(dimensions.z));
+		PheromoneVoxel& voxel = pheromones.at(position.x, position.y, position.z);
+		voxel.pheromones[i % PheromoneVoxel::NUMBER_OF_PHEROMONES] += 500;
+		pyramid.markChanged(pheromones.brickOf(pheromones.posToIndex(position)));
+	}
+	int changed = rebuild();
+	compare("after a few bricks changed");
+	std::printf("%d levels, %d bricks rebuilt after the change\n", pyramid.levelCount(), changed);
+	return failures == 0;
+}
+
+int main(int argc, char** argv) {
+	const std::map<std::string, bool (*)()> checks = {
+		{ "coarse-handoff", checkCoarseHandoff },
+		{ "trace-soil", checkTraceSoil },
+		{ "packed-agent", checkPackedAgent },
+		{ "morton-sort", checkMortonSort },
+		{ "restrict-prolong", checkRestrictProlong },
+		{ "trilinear-sampler", checkTrilinearSampler },
+		{ "nest-distance", checkNestDistance },
+		{ "soil-consumption", checkSoilConsumption },
+		{ "pyramid", checkPyramid },
+	};
+	auto check = argc == 2 ? checks.find(argv[1]) : checks.end();
+	if (check == checks.end()) {
+		std::printf("checks <name>, where name is one of:\n");
+		for (const auto& entry : checks)
+			std::printf("  %s\n", entry.first.c_str());
+		return 2;
+	}
+	//the simulation reports its progress on std::cout, only what a check prints itself is kept
+	std::cout.rdbuf(nullptr);
+	bool passed = check->second();
+	std::printf("%s %s\n", check->first.c_str(), passed ? "passed" : "failed");
+	return passed ? 0 : 1;
+}
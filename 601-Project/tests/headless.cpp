@@ -0,0 +1,171 @@
+/*
+* Runs the simulation without a window, from the same step the viewer's simulation thread takes
+* headless --steps <n> [--world <file>] [mode flags] prints what the colony and the field look like at the end, the mode flags are
+* the panel's toggles: --codebook-sensing --gradient-steering --distance-homing --agent-separation --sort-agents --multi-rate-field
+* --coarse-field --far-sensing, and --budget <ms> for the agent step budget. --verbose keeps the simulation's own messages
+* The agents' random numbers come from their ids and the step, so a run with the same flags always ends the same way
+* --render keeps building the pheromone render data on another thread while the simulation steps, like the viewer does
+* --paths also prints how far agents turn in a step on average, to compare how modes steer them
+* --tlb also prints the data TLB misses per step of the stepping thread and the worker pool, where the kernel allows counting them
+* --continuum-threshold <agents> and --continuum-cell-agents <agents> lower the settings.h limits so a small colony uses the
+* continuum, and --check-continuum fails the run unless agents were handed to it and back without any going missing
+* --check-allocations fails the run (exit code 1) if a step after the first one allocates from the heap. The steps that size
+* buffers for something new, the continuum field starting, are let through like in the viewer. ctest runs it in a few modes
+*/
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <unordered_map>
+
+#include "argh.h"
+#include "AllocationCounter.h"
+#include "settings.h"
+#include "PerfCounters.h"
+#include "Simulation.h"
+
+int main(int argc, char** argv) {
+	argh::parser cmdl(argc, argv, argh::parser::PREFER_PARAM_FOR_UNREG_OPTION);
+	int steps = 200;
+	cmdl("steps", 200) >> steps;
+	std::string worldFile;
+	cmdl("world") >> worldFile;
+	sensingMode = cmdl["codebook-sensing"] ? SensingMode::CODEBOOK : SensingMode::EXACT;
+	steeringMode = cmdl["gradient-steering"] ? SteeringMode::GRADIENT : SteeringMode::SAMPLES;
+	homingMode = cmdl["distance-homing"] ? HomingMode::DISTANCE_FIELD : HomingMode::PHEROMONE;
+	crowdingMode = cmdl["agent-separation"] ? CrowdingMode::SEPARATE : CrowdingMode::IGNORE;
+	fieldStepping = cmdl["multi-rate-field"] ? FieldStepping::MULTI_RATE : FieldStepping::UNIFORM;
+	fieldResolution = cmdl["coarse-field"] ? FieldResolution::ADAPTIVE : FieldResolution::FINE;
+	farSensingMode = cmdl["far-sensing"] ? FarSensingMode::PYRAMID : FarSensingMode::OFF;
+	cmdl("budget", 0.f) >> agentStepBudget;
+	cmdl("continuum-threshold", CONTINUUM_THRESHOLD) >> continuumThreshold;
+	cmdl("continuum-cell-agents", CONTINUUM_CELL_AGENTS) >> continuumCellAgents;
+	bool sortAgents = cmdl["sort-agents"];
+	bool checkAllocations = cmdl["check-allocations"];
+	bool measurePaths = cmdl["paths"];
+	bool render = cmdl["render"];
+	bool countTlbMisses = cmdl["tlb"];
+	bool checkContinuum = cmdl["check-continuum"];
+	if (checkAllocations && !CHECK_STEP_ALLOCATIONS) {
+		std::printf("--check-allocations needs a build with CHECK_STEP_ALLOCATIONS\n");
+		return 2;
+	}
+	//the simulation reports its progress on std::cout, only the summary below is printed unless --verbose
+	if (!cmdl["verbose"])
+		std::cout.rdbuf(nullptr);
+
+	//soil generation draws from rand, so every run starts from the same world
+	std::srand(1);
+	AgentPool agents(AGENT_CAPACITY);
+	GridAllocation pheromoneAllocation;
+	pheromoneAllocation.hugePages = USE_HUGE_PAGES;
+	glm::vec3 pheromoneDimensions = pheromoneGridDimensions();
+	VoxelGrid<PheromoneVoxel> pheromones(pheromoneDimensions.x, pheromoneDimensions.y, pheromoneDimensions.z, pheromoneAllocation);
+	SoilGrid soil = worldFile.empty() ? SoilGrid(SOIL_X_LENGTH, SOIL_Y_LENGTH, SOIL_Z_LENGTH)
+		: SoilGrid(SOIL_X_LENGTH, SOIL_Y_LENGTH, SOIL_Z_LENGTH, worldFile);
+	if (!soil.isLoadedFromFile())
+		generateSoil(soil);
+	spawnStartingAgents(agents);
+
+	std::atomic<bool> running{ true };
+	std::thread renderThread([&]() {
+		ignoreAllocationsOnThisThread();
+		std::vector<pheremoneRenderData> instances;
+		while (render && running.load()) {
+			loadPheremoneRenderData(pheromones, instances);
+			frameArena().reset();
+		}
+	});
+
+	TlbMissCounter tlbCounter(workerPool().workerThreadIds());
+	long long tlbMisses = 0;
+	auto start = std::chrono::steady_clock::now();
+	int allocatingSteps = 0;
+	bool continuumSized = false;
+	//agents move between slots during a step, so their directions are matched up by id
+	std::unordered_map<int, glm::vec3> directions;
+	double turnTotal = 0;
+	long long turnCount = 0;
+	//the continuum only grows by taking agents over (or by its own deliveries) and only shrinks by handing agents back
+	int takeoverSteps = 0, handbackSteps = 0, lossSteps = 0;
+	for (int step = 0; step < steps; step++) {
+		if (sortAgents && step % AGENT_SORT_INTERVAL == 0)
+			agents.sortByMorton();
+		if (measurePaths) {
+			directions.clear();
+			for (int slot = 0; slot < agents.slotCount(); slot++) {
+				if (agents.isActive(slot))
+					directions[agents.id(slot)] = agents.get(slot).direction;
+			}
+		}
+		long long allocationsBefore = allocationCount();
+		bool continuumWasActive = swarmContinuum.isActive();
+		float massBefore = swarmContinuum.mass();
+		float colonyBefore = agents.size() + massBefore;
+		//the first step over the threshold sizes the continuum's buffers, whether or not it hands anyone over
+		bool continuumStarting = !continuumSized && colonyBefore > continuumThreshold;
+		continuumSized = continuumSized || continuumStarting;
+		if (countTlbMisses)
+			tlbCounter.start();
+		stepSimulation(soil, pheromones, agents);
+		if (countTlbMisses)
+			tlbMisses += tlbCounter.stop();
+		long long stepAllocations = allocationCount() - allocationsBefore;
+		if (checkAllocations && step > 0 && !continuumStarting && continuumWasActive == swarmContinuum.isActive() && stepAllocations != 0) {
+			std::printf("step %d made %lld heap allocations\n", step, stepAllocations);
+			allocatingSteps++;
+		}
+		if (checkContinuum) {
+			takeoverSteps += swarmContinuum.mass() > massBefore;
+			handbackSteps += swarmContinuum.mass() < massBefore;
+			//nothing in a step removes members of the colony, an agent handed over or back is still counted once
+			if (agents.size() + swarmContinuum.mass() < colonyBefore - 1e-3f * colonyBefore) {
+				std::printf("step %d lost colony members: %.2f before, %.2f after\n", step, colonyBefore, agents.size() + swarmContinuum.mass());
+				lossSteps++;
+			}
+		}
+		if (measurePaths) {
+			for (int slot = 0; slot < agents.slotCount(); slot++) {
+				auto before = directions.find(agents.id(slot));
+				if (!agents.isActive(slot) || before == directions.end())
+					continue;
+				turnTotal += std::acos(glm::clamp(glm::dot(before->second, agents.get(slot).direction), -1.f, 1.f));
+				turnCount++;
+			}
+		}
+	}
+	float elapsed = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+	running = false;
+	renderThread.join();
+
+	int openSoil = 0;
+	for (int x = 0; x < SOIL_X_LENGTH; x++)
+		for (int y = 0; y < SOIL_Y_LENGTH; y++)
+			for (int z = 0; z < SOIL_Z_LENGTH; z++)
+				openSoil += !soil.isSoil(x, y, z);
+	PheromoneBrickSummary totals = summarizePheromones(pheromones);
+	std::printf("steps %d agents %d continuum %.1f nest %.1f open soil %d\n", steps, agents.size(), swarmContinuum.mass(), nestNutrients, openSoil);
+	std::printf("pheromones wander %.1f food %.1f root %.1f\n", totals.sum[PheromoneVoxel::Wander], totals.sum[PheromoneVoxel::Food], totals.sum[PheromoneVoxel::Root]);
+	if (measurePaths)
+		std::printf("mean turn %.2f degrees per agent step\n", turnCount > 0 ? glm::degrees(turnTotal / turnCount) : 0.0);
+	if (countTlbMisses) {
+		if (tlbCounter.isAvailable())
+			std::printf("dTLB misses %lld per step\n", steps > 0 ? tlbMisses / steps : 0);
+		else
+			std::printf("dTLB misses not available\n");
+	}
+	std::printf("%.2f ms/step\n", steps > 0 ? elapsed / steps : 0.f);
+	if (checkContinuum) {
+		std::printf("continuum grew in %d steps, shrank in %d\n", takeoverSteps, handbackSteps);
+		if (takeoverSteps == 0 || handbackSteps == 0 || lossSteps > 0)
+			return 1;
+	}
+	if (allocatingSteps > 0) {
+		std::printf("%d steps allocated\n", allocatingSteps);
+		return 1;
+	}
+	return 0;
+}